@@ -0,0 +1,320 @@
+//
+// Augmentation policies for AVLTree: what every node keeps about its subtree.
+//
+/**
+ * an augmentation policy is passed to AVLTree (and AVLNode) as a template parameter. the node inherits the policy's
+ * Data, and the tree calls Update on a node whenever its sons change (rotations, joins, the way up after an insert
+ * or a remove). every policy provides:
+ * Data              - the fields added to every node. (an empty Data takes no room in the node)
+ *
+ * Update            - recomputes the fields of a node from its own key/value and the fields of its sons.
+ *
+ * Count             - the number of nodes (copies, in a multiset) in a subtree, used to keep the tree's size right
+ *                     after Split and the set operations. O(1) with the subtree sizes, O(n) without them.
+ *
+ * kHasSize          - true if Data has the size of the subtree in additional_info, which Rank and Select need.
+ *
+ * Dead / Tombstones - whether a node is a tombstone (erased by AVLTree::RemoveNodeLazy, still linked) and the number
+ *                     of tombstones in a subtree. only LiveSubtreeSize has tombstones (kTombstones), for the others
+ *                     Dead is always false and the checks of the tree compile away.
+ *
+ * kUsesValues       - true if Update reads the value of the node, so a change of a value in place must be followed
+ *                     by AVLTree::UpdatePathInfo on the node. (only SubtreeAggregate)
+ *
+ * Copies / kMultiset - the number of copies of the key that a node stands for, which is what Rank and Select count.
+ *                     1 for a node, 0 for a tombstone, and the multiplicity of the node with SubtreeMultiplicity,
+ *                     the only policy in which a key can be added more than once (kMultiset).
+ *
+ * the policies:
+ * NoAugment         - nothing at all, no storage and no work. (no Rank / Select)
+ *
+ * SubtreeSize       - the default, additional_info is the size of the subtree.
+ *
+ * LiveSubtreeSize   - the same, for a tree with lazy deletion: additional_info counts only the live nodes of the
+ *                     subtree, and the tombstones are counted on the side.
+ *
+ * SubtreeMultiplicity - the multiset mode: every node has the number of copies of its key (multiplicity), and
+ *                     additional_info is the number of copies in the subtree, so the tree's size, Rank and Select
+ *                     count the copies. adding or removing a copy of a key that is there only changes the counts.
+ *
+ * SubtreeAggregate  - the size of the subtree, plus the aggregate of a monoid over the values of the subtree,
+ *                     which AVLTree::RangeAggregate uses to answer range queries in O(log n).
+ *                     SubtreeSum / SubtreeMin / SubtreeMax are the common ones.
+ *
+ * a monoid provides value_type, Identity(), Combine(a, b) (associative, with Identity as its neutral element) and
+ * Lift(value), which turns the value of a node into a value_type.
+ */
+
+#ifndef MYAVLTREE_AVLAUGMENT_H
+#define MYAVLTREE_AVLAUGMENT_H
+
+#include <limits>
+
+struct NoAugment {
+    static const bool kHasSize = false;
+    static const bool kTombstones = false;
+    static const bool kMultiset = false;
+    static const bool kUsesValues = false;
+
+    struct Data {
+    };
+
+    template<class Node>
+    static void Update(Node *) {}
+
+    template<class Node>
+    static bool Dead(const Node *) {
+        return false;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *) {
+        return 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *) {
+        return 1;
+    }
+
+    template<class Node>
+    static int Count(const Node *node) {
+        if (!node) return 0;
+        return Count(node->left_son) + Count(node->right_son) + 1;
+    }
+};
+
+//*********************************************************************
+struct SubtreeSize {
+    static const bool kHasSize = true;
+    static const bool kTombstones = false;
+    static const bool kMultiset = false;
+    static const bool kUsesValues = false;
+
+    struct Data {
+        int additional_info = 1; // the size of the subtree.
+    };
+
+    template<class Node>
+    static int Count(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+
+    template<class Node>
+    static void Update(Node *node) {
+        node->additional_info = Count(node->left_son) + Count(node->right_son) + 1;
+    }
+
+    template<class Node>
+    static bool Dead(const Node *) {
+        return false;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *) {
+        return 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *) {
+        return 1;
+    }
+};
+
+//*********************************************************************
+struct LiveSubtreeSize {
+    static const bool kHasSize = true;
+    static const bool kTombstones = true;
+    static const bool kMultiset = false;
+    static const bool kUsesValues = false;
+
+    struct Data {
+        int additional_info = 1; // the number of live nodes in the subtree.
+        int tombstones = 0;      // the number of dead ones.
+        bool dead = false;
+    };
+
+    template<class Node>
+    static int Count(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+
+    template<class Node>
+    static bool Dead(const Node *node) {
+        return node->dead;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *node) {
+        return node ? node->tombstones : 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *node) {
+        return !node->dead;
+    }
+
+    template<class Node>
+    static void Update(Node *node) {
+        node->additional_info = Count(node->left_son) + Count(node->right_son) + !node->dead;
+        node->tombstones = Tombstones(node->left_son) + Tombstones(node->right_son) + node->dead;
+    }
+};
+
+//*********************************************************************
+struct SubtreeMultiplicity {
+    static const bool kHasSize = true;
+    static const bool kTombstones = false;
+    static const bool kMultiset = true;
+    static const bool kUsesValues = false;
+
+    struct Data {
+        int additional_info = 1; // the number of copies in the subtree.
+        int multiplicity = 1;    // the number of copies of the node's key.
+    };
+
+    template<class Node>
+    static int Count(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+
+    template<class Node>
+    static void Update(Node *node) {
+        node->additional_info = Count(node->left_son) + Count(node->right_son) + node->multiplicity;
+    }
+
+    template<class Node>
+    static bool Dead(const Node *) {
+        return false;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *) {
+        return 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *node) {
+        return node->multiplicity;
+    }
+};
+
+//*********************************************************************
+template<class M>
+struct SubtreeAggregate {
+    typedef M Monoid;
+    typedef typename M::value_type value_type;
+    static const bool kHasSize = true;
+    static const bool kTombstones = false;
+    static const bool kMultiset = false;
+    static const bool kUsesValues = true;
+
+    struct Data {
+        int additional_info = 1; // the size of the subtree.
+        value_type aggregate = M::Identity(); // the monoid over the values of the subtree, in key order.
+    };
+
+    template<class Node>
+    static int Count(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+
+    // the aggregate of a subtree, the identity for an empty one.
+    template<class Node>
+    static value_type Aggregate(const Node *node) {
+        return node ? node->aggregate : M::Identity();
+    }
+
+    // the monoid value of the node alone.
+    template<class Node>
+    static value_type Lift(const Node *node) {
+        return M::Lift(node->value);
+    }
+
+    template<class Node>
+    static void Update(Node *node) {
+        node->additional_info = Count(node->left_son) + Count(node->right_son) + 1;
+        node->aggregate = M::Combine(M::Combine(Aggregate(node->left_son), Lift(node)), Aggregate(node->right_son));
+    }
+
+    template<class Node>
+    static bool Dead(const Node *) {
+        return false;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *) {
+        return 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *) {
+        return 1;
+    }
+};
+
+//*********************************************************************
+template<class V>
+struct SumMonoid {
+    typedef V value_type;
+
+    static V Identity() {
+        return V();
+    }
+
+    static V Combine(const V &a, const V &b) {
+        return a + b;
+    }
+
+    template<class X>
+    static V Lift(const X &value) {
+        return static_cast<V>(value);
+    }
+};
+
+template<class V>
+struct MinMonoid {
+    typedef V value_type;
+
+    static V Identity() {
+        return std::numeric_limits<V>::max();
+    }
+
+    static V Combine(const V &a, const V &b) {
+        return b < a ? b : a;
+    }
+
+    template<class X>
+    static V Lift(const X &value) {
+        return static_cast<V>(value);
+    }
+};
+
+template<class V>
+struct MaxMonoid {
+    typedef V value_type;
+
+    static V Identity() {
+        return std::numeric_limits<V>::lowest();
+    }
+
+    static V Combine(const V &a, const V &b) {
+        return a < b ? b : a;
+    }
+
+    template<class X>
+    static V Lift(const X &value) {
+        return static_cast<V>(value);
+    }
+};
+
+template<class V>
+using SubtreeSum = SubtreeAggregate<SumMonoid<V> >;
+
+template<class V>
+using SubtreeMin = SubtreeAggregate<MinMonoid<V> >;
+
+template<class V>
+using SubtreeMax = SubtreeAggregate<MaxMonoid<V> >;
+
+#endif //MYAVLTREE_AVLAUGMENT_H
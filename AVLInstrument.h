@@ -0,0 +1,251 @@
+//
+// Instrumentation policies for AVLTree: counters (and sampled latencies) of what the tree does on its hot paths.
+//
+/**
+ * an instrumentation policy is passed to AVLTree as its fourth template parameter, and the tree keeps one in its
+ * 'instrument' member. the tree calls the hooks below from its hot paths, so with NoInstrumentation (the default)
+ * every hook is an empty inline function and the tree compiles to the same code as without any instrumentation.
+ * the hooks:
+ * OnRotation        - a rotation done while rebalancing after AddNode / RemoveNode, with its kind.
+ *
+ * OnSearch          - a descent from the root finished (find, Rank, Select, lower/upper bound, the descent of
+ *                     AddNode), with the number of nodes it visited.
+ *
+ * OnRetrace         - the rebalancing after AddNode / RemoveNode finished, with the nodes whose height was
+ *                     recomputed, the nodes above them that only had their augmentation refreshed, and whether
+ *                     it had to go all the way to the root.
+ *
+ * OnAllocate / OnDeallocate - a node was created / destroyed.
+ *
+ * OnHeight          - the height of the tree after a change.
+ *
+ * OnDiagnostic      - something the caller may want to know about, that is not an error: a TreeDiagnostic and the
+ *                     key it is about. (the tree never prints, a policy that wants a log writes it from here)
+ *
+ * Scope             - an object that lives for the duration of one public operation (TreeOp) and times it, if the
+ *                     policy samples latencies.
+ *
+ * Snapshot          - copies the counters into an InstrumentationSnapshot. (empty for NoInstrumentation)
+ *
+ * the policies:
+ * NoInstrumentation         - the default, nothing.
+ *
+ * Instrumentation<kSampleEvery> - counts everything, and times one of every kSampleEvery calls of each operation
+ *                     into a log2 latency histogram. (0 turns the timing off)
+ *
+ * the counters are plain integers of the tree, so an instrumented tree must not be read from several threads at
+ * the same time. the bulk operations (Split, Join, the set operations, the batches) rebalance with joins, partly
+ * in parallel, and their rotations are not counted, their allocations are.
+ */
+
+#ifndef MYAVLTREE_AVLINSTRUMENT_H
+#define MYAVLTREE_AVLINSTRUMENT_H
+
+#include <chrono>
+#include <cstdint>
+
+enum class RotationKind {
+    kLeft,  // RR, LeftRotate
+    kRight, // LL, RightRotate
+    kLeftRight,
+    kRightLeft
+};
+
+enum class TreeDiagnostic {
+    kDuplicateKey, // AddNode of a key that was already there, the value was dropped.
+    kCount
+};
+
+enum class TreeOp {
+    kFind,
+    kAddNode,
+    kRemoveNode,
+    kRank,
+    kSelect,
+    kCount // the number of operations, not an operation.
+};
+
+//*********************************************************************
+/**
+ * latencies in buckets of powers of two: bucket i counts the samples that took [2^i, 2^(i+1)) nanoseconds.
+ */
+struct LatencyHistogram {
+    static const int kBuckets = 40; // up to ~18 minutes.
+
+    long long buckets[kBuckets] = {};
+    long long count = 0;
+
+    void Add(long long nanoseconds) {
+        int bucket = 0;
+        while (bucket + 1 < kBuckets && (nanoseconds >> (bucket + 1)) > 0) {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+    }
+
+    /**
+     * @param fraction - in [0, 1], 0.99 for the p99.
+     * @return an upper bound of the latency below which the received fraction of the samples is, in nanoseconds.
+     * (the end of the bucket it falls in) 0 if there are no samples.
+     */
+    long long Percentile(double fraction) const {
+        if (!count) return 0;
+        long long rank = static_cast<long long>(fraction * count);
+        if (rank >= count) rank = count - 1;
+        long long seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets[i];
+            if (seen > rank) return (2LL << i) - 1;
+        }
+        return (2LL << (kBuckets - 1)) - 1;
+    }
+};
+
+//*********************************************************************
+struct InstrumentationSnapshot {
+    long long rotations[4] = {};        // by RotationKind.
+    long long searches = 0;
+    long long search_steps = 0;          // the nodes visited by all the searches together.
+    int max_search_path = 0;
+    long long retraces = 0;
+    long long retrace_steps = 0;         // nodes whose height and balance were recomputed.
+    long long info_steps = 0;            // nodes above them that only had their augmentation refreshed.
+    long long retraces_to_root = 0;      // retraces whose heights kept changing all the way up.
+    long long allocations = 0;
+    long long deallocations = 0;
+    int max_height = -1;
+    long long diagnostics[static_cast<int>(TreeDiagnostic::kCount)] = {}; // by TreeDiagnostic.
+    LatencyHistogram latency[static_cast<int>(TreeOp::kCount)]; // by TreeOp, only the sampled calls.
+
+    long long Rotations(RotationKind kind) const {
+        return rotations[static_cast<int>(kind)];
+    }
+
+    long long Diagnostics(TreeDiagnostic diagnostic) const {
+        return diagnostics[static_cast<int>(diagnostic)];
+    }
+
+    const LatencyHistogram &Latency(TreeOp op) const {
+        return latency[static_cast<int>(op)];
+    }
+
+    double AverageSearchPath() const {
+        return searches ? static_cast<double>(search_steps) / searches : 0;
+    }
+};
+
+//*********************************************************************
+struct NoInstrumentation {
+    static const bool kEnabled = false;
+
+    struct Scope {
+        Scope(NoInstrumentation &, TreeOp) {}
+    };
+
+    void OnRotation(RotationKind) {}
+
+    void OnSearch(int) {}
+
+    void OnRetrace(int, int, bool) {}
+
+    void OnAllocate() {}
+
+    void OnDeallocate() {}
+
+    void OnHeight(int) {}
+
+    template<class Key>
+    void OnDiagnostic(TreeDiagnostic, const Key &) {}
+
+    InstrumentationSnapshot Snapshot() const {
+        return InstrumentationSnapshot();
+    }
+
+    void Reset() {}
+};
+
+//*********************************************************************
+template<int kSampleEvery = 1024>
+class Instrumentation {
+public:
+    static const bool kEnabled = true;
+
+    /**
+     * times the operation if it is one of the sampled calls, the clock is not read for the others.
+     */
+    class Scope {
+    public:
+        Scope(Instrumentation &owner, TreeOp op) : owner(owner), op(static_cast<int>(op)), sampled(false) {
+            if (kSampleEvery > 0 && ++owner.calls[this->op] % kSampleEvery == 0) {
+                sampled = true;
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Scope() {
+            if (!sampled) return;
+            owner.counters.latency[op].Add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Instrumentation &owner;
+        int op;
+        bool sampled;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void OnRotation(RotationKind kind) {
+        counters.rotations[static_cast<int>(kind)]++;
+    }
+
+    void OnSearch(int path_length) {
+        counters.searches++;
+        counters.search_steps += path_length;
+        if (path_length > counters.max_search_path) counters.max_search_path = path_length;
+    }
+
+    void OnRetrace(int retrace_steps, int info_steps, bool reached_root) {
+        counters.retraces++;
+        counters.retrace_steps += retrace_steps;
+        counters.info_steps += info_steps;
+        counters.retraces_to_root += reached_root;
+    }
+
+    void OnAllocate() {
+        counters.allocations++;
+    }
+
+    void OnDeallocate() {
+        counters.deallocations++;
+    }
+
+    void OnHeight(int height) {
+        if (height > counters.max_height) counters.max_height = height;
+    }
+
+    template<class Key>
+    void OnDiagnostic(TreeDiagnostic diagnostic, const Key &) {
+        counters.diagnostics[static_cast<int>(diagnostic)]++;
+    }
+
+    InstrumentationSnapshot Snapshot() const {
+        return counters;
+    }
+
+    void Reset() {
+        counters = InstrumentationSnapshot();
+    }
+
+private:
+    InstrumentationSnapshot counters;
+    std::uint64_t calls[static_cast<int>(TreeOp::kCount)] = {};
+};
+
+typedef Instrumentation<> DefaultInstrumentation;
+
+#endif //MYAVLTREE_AVLINSTRUMENT_H
@@ -2,34 +2,37 @@
 // Created by ward_ on 10/3/2020.
 //
 #include<new>
-#include<iostream>
+#include<utility>
 #ifndef MYAVLTREE_AVLNODE_H
 #define MYAVLTREE_AVLNODE_H
 
+#include "AVLAugment.h"
 
-template <class T>
-class AVLNode {
+// the fields that describe the subtree (additional_info by default, the size of the subtree) come from the
+// augmentation policy, see AVLAugment.h.
+// the value is stored in the node itself, right after the key, so a small value shares the cache line of the key
+// and reading it after a search costs nothing more.
+// the key is an int by default, AVLTree passes its own Key type.
+template <class T, class Augment = SubtreeSize, class Key = int>
+class AVLNode : public Augment::Data {
 public:
-    int key;
-    T* value;
-    AVLNode<T>* parent;
-    AVLNode<T>* left_son;
-    AVLNode<T>* right_son;
+    Key key;
+    T value;
+    AVLNode* parent;
+    AVLNode* left_son;
+    AVLNode* right_son;
     int height;
-    int additional_info; // assuming for now it's the size of the subtree
     int balance_factor;
 
+    /**
+     * constructs the value in place from the received arguments. the node is not linked to anything.
+     */
+    template<class... Args>
+    explicit AVLNode(const Key &key, Args &&... args) : key(key), value(std::forward<Args>(args)...), parent(nullptr),
+            left_son(nullptr), right_son(nullptr), height(0), balance_factor(0) {}
 
-    AVLNode (int key, T *value, AVLNode<T> *parent= nullptr, AVLNode<T> *left_son = nullptr,
-            AVLNode<T> *right_son= nullptr,int height=0,int additional_info=1, int balance_factor=0) : key(key), value(value), parent(parent),
-            left_son(left_son), right_son(right_son),height(height), additional_info(additional_info), balance_factor(balance_factor) {}
-
-     ~AVLNode() {
-        parent= nullptr;
-        left_son= nullptr;
-        right_son= nullptr;
-        delete value;
-     }
+    AVLNode(const AVLNode &) = delete;
+    AVLNode &operator=(const AVLNode &) = delete;
 
     bool operator==(const AVLNode &node) const {
         return key == node.key;
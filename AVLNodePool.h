@@ -0,0 +1,198 @@
+//
+// Node allocation policies for AVLTree.
+//
+/**
+ * an allocation policy is a class template over the node type, and it is passed to AVLTree as its second
+ * template parameter. the tree constructs and destroys the nodes itself, the policy only hands out raw storage.
+ * every policy provides the following:
+ * Allocate          - returns uninitialized storage big enough for one node.
+ *
+ * Deallocate        - takes back the storage of a single node that was already destroyed.
+ *
+ * ReleaseAll        - frees the storage of every node handed out so far, in one go.
+ *
+ * Share             - makes two allocators of the same type draw from the same storage, so nodes can move
+ *                     from one tree to the other. (used by Split, Join and the set operations)
+ *
+ * IsExclusive       - true if no other allocator shares the storage of this one.
+ *
+ * kBulkRelease      - true if ReleaseAll actually frees the nodes, in which case the tree does not need to
+ *                     return its nodes one by one when it is destroyed. (as long as the storage is not shared)
+ *
+ * NewDeleteAllocator - plain ::operator new / ::operator delete per node. (the old behaviour)
+ * AVLNodePool        - the default. carves nodes out of big slabs and recycles freed nodes through a free list.
+ */
+
+#ifndef MYAVLTREE_AVLNODEPOOL_H
+#define MYAVLTREE_AVLNODEPOOL_H
+
+#include <memory>
+#include <new>
+
+template<class Node>
+class NewDeleteAllocator {
+public:
+    static const bool kBulkRelease = false;
+
+    NewDeleteAllocator() = default;
+    NewDeleteAllocator(const NewDeleteAllocator &) = delete;
+    NewDeleteAllocator &operator=(const NewDeleteAllocator &) = delete;
+
+    void *Allocate() {
+        return ::operator new(sizeof(Node));
+    }
+
+    void Deallocate(Node *node) {
+        ::operator delete(node);
+    }
+
+    void ReleaseAll() {}
+
+    bool IsExclusive() {
+        return true;
+    }
+
+    void Share(NewDeleteAllocator &) {}
+};
+
+template<class Node>
+class AVLNodePool {
+    // a free slot holds the link to the next free slot, a used one holds the node itself.
+    union Slot {
+        Slot *next;
+        alignas(Node) unsigned char storage[sizeof(Node)];
+    };
+
+    // the header of a slab, its kNodesPerSlab slots follow it in the same allocation.
+    struct alignas(Slot) Slab {
+        Slab *next;
+    };
+
+    // the actual storage. pools that were shared point (through forward) to the arena that took over their
+    // slabs, and an arena is freed when the last pool or arena pointing at it is gone.
+    struct Arena {
+        Slab *slabs = nullptr;
+        Slot *free_list = nullptr;
+        Slot *bump = nullptr;
+        Slot *bump_end = nullptr;
+        std::shared_ptr<Arena> forward;
+
+        ~Arena() {
+            while (slabs) {
+                Slab *next = slabs->next;
+                ::operator delete(slabs);
+                slabs = next;
+            }
+        }
+    };
+
+public:
+    static const bool kBulkRelease = true;
+    static const int kNodesPerSlab = 256;
+
+    AVLNodePool() = default;
+
+    AVLNodePool(const AVLNodePool &) = delete;
+    AVLNodePool &operator=(const AVLNodePool &) = delete;
+    //*********************************************************************
+    /**
+     * returns storage for one node. recycled nodes are used first, then the unused tail of the newest slab,
+     * and only then a new slab is allocated.
+     */
+    void *Allocate() {
+        Arena &current = Resolve();
+        if (current.free_list) {
+            Slot *slot = current.free_list;
+            current.free_list = slot->next;
+            return slot;
+        }
+        if (current.bump == current.bump_end) {
+            NewSlab(current);
+        }
+        return current.bump++;
+    }
+    //*********************************************************************
+    /**
+     * puts the storage of a destroyed node on the free list, it is not given back to the system until ReleaseAll.
+     * @param node
+     */
+    void Deallocate(Node *node) {
+        Arena &current = Resolve();
+        Slot *slot = reinterpret_cast<Slot *>(node);
+        slot->next = current.free_list;
+        current.free_list = slot;
+    }
+    //*********************************************************************
+    /**
+     * drops this pool's hold on its slabs. they are freed right away unless the storage is shared with another
+     * pool, so any node that was still alive is gone after this and the caller must have already destroyed
+     * whatever needed destroying.
+     */
+    void ReleaseAll() {
+        arena.reset();
+    }
+    //*********************************************************************
+    /**
+     * true if no other pool draws from the same storage, so ReleaseAll frees everything.
+     */
+    bool IsExclusive() {
+        return !arena || (Resolve(), arena.use_count() == 1);
+    }
+    //*********************************************************************
+    /**
+     * after the call both pools draw from the same storage: the slabs and free nodes of the other pool are moved
+     * into this one and the other pool is pointed at it. the storage lives until the last pool using it is gone,
+     * so nodes can move freely between the two trees. (the pools must not be used from two threads at once)
+     * @param other
+     */
+    void Share(AVLNodePool &other) {
+        Arena &mine = Resolve();
+        Arena &theirs = other.Resolve();
+        if (&mine == &theirs) return;
+        if (theirs.slabs) {
+            Slab *last = theirs.slabs;
+            while (last->next) last = last->next;
+            last->next = mine.slabs;
+            mine.slabs = theirs.slabs;
+            theirs.slabs = nullptr;
+        }
+        // the free slots of the other pool and the unused tail of its newest slab become our free slots.
+        while (theirs.free_list) {
+            Slot *slot = theirs.free_list;
+            theirs.free_list = slot->next;
+            slot->next = mine.free_list;
+            mine.free_list = slot;
+        }
+        while (theirs.bump != theirs.bump_end) {
+            Slot *slot = theirs.bump++;
+            slot->next = mine.free_list;
+            mine.free_list = slot;
+        }
+        theirs.forward = arena;
+        other.arena = arena;
+    }
+
+private:
+    std::shared_ptr<Arena> arena;
+
+    Arena &Resolve() {
+        if (!arena) {
+            arena = std::make_shared<Arena>();
+        }
+        while (arena->forward) {
+            arena = arena->forward;
+        }
+        return *arena;
+    }
+
+    static void NewSlab(Arena &current) {
+        void *memory = ::operator new(sizeof(Slab) + kNodesPerSlab * sizeof(Slot));
+        Slab *slab = static_cast<Slab *>(memory);
+        slab->next = current.slabs;
+        current.slabs = slab;
+        current.bump = reinterpret_cast<Slot *>(slab + 1);
+        current.bump_end = current.bump + kNodesPerSlab;
+    }
+};
+
+#endif //MYAVLTREE_AVLNODEPOOL_H
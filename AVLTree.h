@@ -3,15 +3,31 @@
 //
 /**
  * Generic AVL Tree
- * the tree is implemented as ranked tree. for a regular AVL tree, make the "idditional_info" field a note.
+ * the tree is a ranked tree: what a node keeps about its subtree is decided by the augmentation policy, the third
+ * template parameter (see AVLAugment.h). the default SubtreeSize keeps the size of the subtree in additional_info,
+ * for Rank and Select. NoAugment keeps nothing (a plain AVL tree), LiveSubtreeSize and SubtreeMultiplicity count
+ * the live nodes and the copies of the keys, and SubtreeSum/Min/Max also keep an aggregate of the values for
+ * RangeAggregate.
+ * the keys are ints by default. the fifth and sixth template parameters are the key type and its comparator (a
+ * type, std::less<Key> by default, inlined in every comparison), AVLMap<Key, T, Compare> spells them first. with a
+ * transparent comparator (std::less<>) find, lower_bound, upper_bound, Rank and Multiplicity also take keys of
+ * other types, like a std::string_view in a tree of std::string. integer keys in the natural order are passed by
+ * value and compared with ==, and Freeze / WriteImage / BuildFromImage, whose formats are keyed by int, need them.
+ * the second template parameter is the node allocation policy (see AVLNodePool.h), by default the nodes
+ * are taken from a per-tree slab pool that recycles removed nodes.
  * the following functions are available:
  * Constructor       - Creates a new empty AVL Tree.
- * Destructor        - Deletes an existing AVL Tree.
+ * Destructor        - Deletes an existing AVL Tree. with a pooled allocator the node memory is
+ *                     released a whole slab at a time.
+ *
+ * CreateNode        - constructs a new node in storage taken from the tree's allocator.
+ *
+ * DestroyNode       - destroys a node and gives its storage back to the tree's allocator.
  *
  * max               - returns the maximum between two integers.
  *
- * setBalance        - updates the height balance of the received node based
- *                        on the equation height(leftSon)-height(RightSon)
+ * UpdateBalance     - updates the height and the balance factor, height(left_son) - height(right_son), of the
+ *                     received node. (UpdateInfo also updates its augmentation first)
  *
  * RightRotate       - executes an LL Rotation. (node is B)
  *
@@ -21,62 +37,225 @@
  *
  * RLRotate          - executes an LL Rotation and then an RR Rotation.
  *
- * reBalance         - rearranges the AVL tree to be balanced after adding
- *                     or removing a node.
+ * UpdateBalanceAndFix - rearranges the AVL tree to be balanced after adding
+ *                     or removing a node. (iterative, it stops as
+ *                     soon as the height of a subtree stays the same)
+ *
+ * find              - returns the node with the received key, or nullptr.
+ *
+ * Rank / Select     - the index(+1) of a key in sorted order (or -1), the node at an index(+1). (with subtree sizes)
  *
- * Find              - checks if the AVL tree contains a node with the received key.
+ * FindBatch / RankBatch / SelectBatch - find / Rank / Select for many keys at once. the searches walk down the
+ *                     tree together and prefetch their next nodes, so their cache misses overlap.
  *
- * FindAndReturn     - checks if the AVL tree contains a node with the received
- *                      key and returns a pointer.
+ * begin / end       - bidirectional iterators over the nodes in key order, they walk with the parent pointers.
  *
- * Find_aux          - Finds a node in the AVL tree based on the matching data/value
- *                     and returns a pointer to the node.
+ * lower_bound       - an iterator to the first node with a key bigger or equal to the received key.
  *
- * add               - creates a new node with the received parameters, adds
+ * upper_bound       - an iterator to the first node with a key bigger than the received key.
+ *
+ * range             - a lazy view of the nodes with keys in [low, high]. it only visits the nodes it yields,
+ *                     O(log n + k) for k nodes, allocates nothing and can be stopped (and resumed) at any point.
+ *
+ * AddNode           - creates a new node with the received key and value, adds
  *                     it to the AVL tree and reorganizes the tree to
  *                     keep it balanced. returns true if added successfully.
  *
- * updateParents     - given a root of an avl tree with only pointing down arrows,
+ * Emplace           - the same, with the value constructed in place inside the node from the received arguments.
+ *                     (the values are stored in the nodes, not behind a pointer)
+ *
+ * TryEmplace / InsertOrAssign / GetOrCreate - the upserts, each in one descent: add if missing (TryEmplace is
+ *                     Emplace), add or overwrite the value, add a default value or return the node that is there.
+ *                     the tree never prints anything, a duplicate AddNode goes to instrument.OnDiagnostic.
+ *
+ * EmplaceHint       - Emplace next to a hint (a node or an iterator), without a search if the hint is right.
+ *
+ * SetFingerMode     - the tree remembers where the last key was added, in finger mode a key that goes right next
+ *                     to it is added without a search. increasing (or decreasing) keys are added in amortized O(1).
+ *
+ * UpdateParents     - given a root of an avl tree with only pointing down arrows,
  *                     it updates the parent of each node in the tree.
  *
- * Delete            - Deletes a node in the list that contains the same data/value as
- *                     the received one. returns true if the node is found and
- *                     deleted.
+ * BuildFromSorted   - replaces the content of the tree with a perfectly balanced tree built in
+ *                     linear time from a range of (key, value) pairs sorted by key.
+ *
+ * BuildFromUnsorted - same as BuildFromSorted, but sorts the pairs first (in parallel) and drops
+ *                     the duplicate keys.
+ *
+ * JoinNodes         - joins two subtrees (and optionally a pivot node between them) into one balanced
+ *                     subtree in O(log n), using the rotations.
+ *
+ * SplitNode         - splits a subtree by a key into the smaller keys, the matching node and the bigger
+ *                     keys in O(log n).
+ *
+ * Join              - moves all the nodes of another tree, whose keys are all bigger, into this tree.
+ *
+ * Split             - moves all the nodes with keys bigger than the received key into another tree.
+ *
+ * Union             - moves all the nodes of another tree into this one. (on equal keys this tree's value wins)
  *
- * DeleteByPointer   - Deletes a node in the list that matches the node pointed
- *                     at by the received pointer, and reorganizes the tree to
- *                     keep it balanced.
+ * Intersection      - keeps only the keys that are also in the other tree.
  *
- * Size              - returns the size of the AVL tree in the received pointer
- *                     and returns true.
+ * Difference        - removes the keys that are in the other tree.
+ *                     the three set operations recurse on the two halves in parallel on a thread pool.
+ *
+ * InsertBatch       - adds many (key, value) pairs at once: the batch is sorted and merged into the tree like a
+ *                     Union, so the descents are shared and every touched subtree is rebalanced once. a batch
+ *                     that is big compared to the tree rebuilds the whole tree in linear time instead.
+ *
+ * EraseBatch        - the same for removing many keys at once.
+ *
+ * RemoveNode(key)   - removes the node with the received key, if it is there, and reorganizes the tree to keep
+ *                     it balanced.
+ *
+ * Extract           - removes a key and moves its value out to the caller.
+ *
+ * PeekMin / PeekMax - the nodes with the smallest and the biggest keys in O(1), the tree keeps them (leftmost and
+ *                     rightmost) through every change.
+ *
+ * PopMin / PopMax   - removes the node with the smallest / biggest key, without a search, and moves its key and
+ *                     value out. (for using the tree as a priority queue)
+ *
+ * Multiset          - with the SubtreeMultiplicity augmentation a key can be added more than once: the node keeps
+ *                     the number of copies (multiplicity), Emplace / AddNode of a key that is there add a copy and
+ *                     RemoveNode(key) removes one, in O(log n) without allocating or rotating. size, Rank and Select
+ *                     count the copies, the iterators visit every node once. RemoveNode(Node *), Extract, PopMin /
+ *                     PopMax, EraseBatch and the set operations work on whole nodes (all the copies at once), and
+ *                     BuildFromUnsorted keeps one copy of a key. Multiplicity(key) returns the number of copies.
+ *
+ * RemoveNodeLazy    - removes a key by turning its node into a tombstone, without rebalancing or freeing anything.
+ *                     with the LiveSubtreeSize augmentation the sizes count only the live nodes, so Rank, Select
+ *                     and the iterators skip the tombstones. CompactTombstones removes a few of them at a time,
+ *                     PurgeTombstones all of them in O(n). (by itself past max_tombstone_fraction, if it's set)
+ *
+ * RemoveNode(node)  - the same for a node of the tree, without a search.
+ *
+ * size              - the number of keys in the tree (copies included, tombstones not), a member.
  *
  * ClearTree         - Deletes all the left and right subroots of the given node
  *                     and then deletes the node itself.DOES NOT maintain the tree balanced
  *
- * inorder           - executes an inorder tour over the AVL tree nodes and returns
- *                     (god knows what , ask fadi)
+ * InOrderTraversal  - copies the keys of a subtree, in order, into an array.
+ *
+ * PreOrderTraversal / PostOrderTraversal - call a function on every node of a subtree, in pre / post order.
+ *
+ * ParallelForEach   - calls a function on every node, on a thread pool. the tree is cut into pieces of about the
+ *                     same size by the subtree sizes, and the threads that are done early take the pieces left.
+ *
+ * TransformReduce   - transforms every node and combines the results in key order, in parallel. (Reduce does the
+ *                     same on the values) the combine only has to be associative.
+ *
+ * print_tree        - prints the tree as how it should look graphically, to the received stream.
+ *
+ * RangeAggregate    - returns the aggregate (sum, min, max...) of the values whose keys are in [low, high] in
+ *                     O(log n). only with a SubtreeAggregate augmentation.
+ *
+ * the snapshots are made by free functions in their own headers, so only their users include them:
+ * Freeze(tree)      - returns a read-only, cache friendly snapshot of the tree. (FrozenAVLTree.h, SIMD intrinsics)
  *
- * PrintTree         - prints the tree as how it should look graphically.
+ * WriteImage(tree, path) - writes the tree to a file that MappedAVLTree maps and queries in place. (MappedAVLTree.h,
+ *                     POSIX mmap)
+ *
+ * BuildFromImage(tree, image) - replaces the content of the tree with the content of a mapped image, in O(n).
+ *
+ * instrument        - the fourth template parameter is the instrumentation policy (see AVLInstrument.h). by default
+ *                     it is NoInstrumentation and costs nothing, Instrumentation<> counts the rotations, the search
+ *                     paths, the retraces, the allocations and the height, and samples the latency of find, AddNode,
+ *                     RemoveNode, Rank and Select. instrument.Snapshot() exports the counters.
  */
 
 #ifndef MYAVLTREE_AVLTREE_H
 #define MYAVLTREE_AVLTREE_H
 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "AVLInstrument.h"
 #include "AVLNode.h"
+#include "AVLNodePool.h"
+#include "ThreadPool.h"
 
-using std::cout;
-using std::endl;
+// true if the comparator is transparent (has is_transparent, like std::less<>): it compares keys of other types.
+template<class Compare, class = void>
+struct IsTransparentCompare : std::false_type {};
 
-template<class T>
+template<class Compare>
+struct IsTransparentCompare<Compare, typename std::conditional<true, void, typename Compare::is_transparent>::type>
+        : std::true_type {};
+
+template<class T, template<class> class Allocator = AVLNodePool, class Augment = SubtreeSize,
+        class Instrument = NoInstrumentation, class Key = int, class Compare = std::less<Key> >
 class AVLTree {
 public:
-    AVLNode<T> *root;
+    typedef AVLNode<T, Augment, Key> Node;
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef Compare key_compare;
+    typedef Augment augment_type;
+    // the keys are passed by value if they are scalars (int, long long, pointers), by reference otherwise.
+    typedef typename std::conditional<std::is_scalar<Key>::value, Key, const Key &>::type KeyArg;
+    // the lookups take any key type the comparator can compare with Key, if the comparator is transparent.
+    template<class K>
+    using TransparentKey = typename std::enable_if<!std::is_same<K, Key>::value &&
+                                                   IsTransparentCompare<Compare>::value>::type;
+    // integer keys in the natural order: keys are compared for equality with ==, in one instruction.
+    static const bool kIntegerKeys = std::is_integral<Key>::value &&
+                                     (std::is_same<Compare, std::less<Key> >::value ||
+                                      std::is_same<Compare, std::less<> >::value);
+
+    Node *root;
     int size;
     int additional_info_for_tree; // for example, the key of the node with the max value.
+    Node *leftmost;  // the node with the smallest key, nullptr if the tree is empty. (kept by every change)
+    Node *rightmost; // the node with the biggest key.
+    Allocator<Node> allocator;
 
+    Instrument instrument; // the counters of the hot paths, nothing by default. (see AVLInstrument.h)
+
+    bool finger_mode;   // try the finger before searching from the root. (SetFingerMode)
+    Node *finger;       // the last added node, nullptr if unknown.
+    Node *finger_prev;  // the nodes right before and after it in key order, nullptr at the ends.
+    Node *finger_next;
+
+    // RemoveNodeLazy purges the tombstones once they are more than this fraction of the nodes. the default, 1,
+    // never does: a purge is O(n), so it is left to the caller (CompactTombstones / PurgeTombstones).
+    double max_tombstone_fraction;
+
+    //*********************************************************************
+    // a root passed here must have been created with this tree's CreateNode.
+    explicit AVLTree(Node *root = nullptr, int size = 0, int additional_info_for_tree = -1) : root(root),
+                                            size(size),additional_info_for_tree(additional_info_for_tree),
+                                            leftmost(Minimum(root)), rightmost(Maximum(root)), finger_mode(false), finger(nullptr), finger_prev(nullptr),
+                                            finger_next(nullptr), max_tombstone_fraction(1) {}
     //*********************************************************************
-    explicit AVLTree(AVLNode<T> *root = nullptr, int size = 0, int additional_info_for_tree = -1) : root(root),
-                                            size(size),additional_info_for_tree(additional_info_for_tree) {}
+    /**
+     * constructs a new node in storage taken from the allocator of the tree, with its value constructed in place
+     * from the received arguments.
+     * @return ptr to the new node, it is not linked to the tree yet.
+     */
+    template<class... Args>
+    Node *CreateNode(KeyArg key, Args &&... args) {
+        Node *node = new(allocator.Allocate()) Node(key, std::forward<Args>(args)...);
+        Augment::Update(node);
+        instrument.OnAllocate();
+        return node;
+    }
+    //*********************************************************************
+    /**
+     * destroys the node (and its value) and gives its storage back to the allocator of the tree.
+     * @param node - must already be unlinked from the tree.
+     */
+    void DestroyNode(Node *node) {
+        node->~Node();
+        allocator.Deallocate(node);
+        instrument.OnDeallocate();
+    }
     //*********************************************************************
     int abs(int x) {
         if (x < 0) return -x;
@@ -90,27 +269,65 @@ public:
         return a;
     }
     //*********************************************************************
+    /**
+     * the comparisons of the keys. the comparator is a type, default constructed on every call, so it is inlined
+     * like the < of an int. two keys are equal if neither is smaller, integer keys just use ==.
+     */
+    template<class A, class B>
+    static bool Less(const A &a, const B &b) {
+        return Compare()(a, b);
+    }
+
+    template<class A, class B>
+    static bool Equal(const A &a, const B &b) {
+        if constexpr (kIntegerKeys) {
+            return a == b;
+        } else {
+            return !Compare()(a, b) && !Compare()(b, a);
+        }
+    }
+    //*********************************************************************
     /**
      * returns the index(+1) of the node with the matching key if it was in a sorted array
+     * (in a multiset every copy takes an index, this is the index of the first copy of the key)
      * @param key
      * @return index+1 in the sorted array
      */
-    int Rank(int key) {
+    int Rank(KeyArg key) {
+        return RankOf(key);
+    }
+
+    template<class K, class = TransparentKey<K> >
+    int Rank(const K &key) {
+        return RankOf(key);
+    }
+
+    template<class K>
+    int RankOf(const K &key) {
+        static_assert(Augment::kHasSize, "Rank needs an augmentation that keeps the subtree sizes");
+        typename Instrument::Scope scope(instrument, TreeOp::kRank);
         int r = 0;
-        AVLNode<T> *current = root;
+        int path = 0;
+        Node *current = root;
         if (!root) return -1;
         while (true) {
-            if (!current) return -1;
-            if (key > current->key) {
+            if (!current) {
+                instrument.OnSearch(path);
+                return -1;
+            }
+            path++;
+            if (Less(current->key, key)) {
                 int left_size = 0;
                 if (current->left_son) {
                     left_size = current->left_son->additional_info;
                 }
-                r = r + left_size + 1;
+                r = r + left_size + Augment::Copies(current); // (a tombstone takes no index)
                 current = current->right_son;
-            } else if (key < current->key) {
+            } else if (Less(key, current->key)) {
                 current = current->left_son;
             } else {// there is a match
+                instrument.OnSearch(path);
+                if (Augment::Dead(current)) return -1;
                 int left_size = 0;
                 if (current->left_son) {
                     left_size = current->left_son->additional_info;
@@ -124,41 +341,262 @@ public:
     //*********************************************************************
     /**
      * assuming the tree was sorted in an array, the algorithm returns the node which is in the received index of the array.
+     * (in a multiset, the node of the copy at that index)
      * @param index
      * @return ptr to the matching node with the index.
      */
-    AVLNode<T> *Select(int index) {
-        AVLNode<T> *current = root;
-        if (!root) return nullptr;
-        while (true) {
-            if (!current) return nullptr;
-            if (current->left_son && current->left_son->additional_info > (index - 1)) {
+    Node *Select(int index) {
+        static_assert(Augment::kHasSize, "Select needs an augmentation that keeps the subtree sizes");
+        typename Instrument::Scope scope(instrument, TreeOp::kSelect);
+        Node *current = root;
+        int path = 0;
+        while (current) {
+            path++;
+            int left_size = 0;
+            if (current->left_son) {
+                left_size = current->left_son->additional_info;
+            }
+            int self = Augment::Copies(current); // (a tombstone takes no index, a key with copies takes one each)
+            if (index <= left_size) {
+                current = current->left_son;
+            } else if (index <= left_size + self) {
+                break;
+            } else {
+                index = index - left_size - self;
+                current = current->right_son;
+            }
+        }
+        instrument.OnSearch(path);
+        return current;
+    }
+    //*********************************************************************
+    /**
+     * the batched lookups: find / Rank / Select for many keys at once. kBatchLanes searches walk down the tree
+     * together, one level each in turn, and every search prefetches the node it goes to next. by the time a
+     * search comes back to its node the node is (hopefully) in the cache, so on a tree bigger than the cache the
+     * memory latencies of the searches overlap instead of being paid one after the other. a search that ends
+     * gives its lane to the next key.
+     * the results are in the order of the keys (indices), the searches are not counted by the instrumentation.
+     * @param keys
+     * @param results - resized to the number of keys. results[i] is find(keys[i]).
+     */
+    void FindBatch(const std::vector<Key> &keys, std::vector<Node *> &results) {
+        int count = static_cast<int>(keys.size());
+        results.resize(count);
+        Node *node[kBatchLanes];
+        int which[kBatchLanes];
+        int lanes = 0, next = 0;
+        for (; lanes < kBatchLanes && next < count; lanes++, next++) {
+            node[lanes] = root;
+            which[lanes] = next;
+        }
+        while (lanes) {
+            for (int lane = 0; lane < lanes;) {
+                Node *current = node[lane];
+                const Key &key = keys[which[lane]];
+                if (current && !Equal(key, current->key)) {
+                    current = Less(key, current->key) ? current->left_son : current->right_son;
+                    if (current) {
+                        PrefetchNode(current);
+                        node[lane++] = current;
+                        continue;
+                    }
+                }
+                results[which[lane]] = current && !Augment::Dead(current) ? current : nullptr; // the match, or nullptr.
+                if (!NextBatchSearch(next, count, lanes, lane, node, which)) continue;
+                lane++;
+            }
+        }
+    }
+    //*********************************************************************
+    /**
+     * Rank for many keys at once, in lockstep like FindBatch.
+     * @param keys
+     * @param ranks - resized to the number of keys. ranks[i] is Rank(keys[i]).
+     */
+    void RankBatch(const std::vector<Key> &keys, std::vector<int> &ranks) {
+        static_assert(Augment::kHasSize, "RankBatch needs an augmentation that keeps the subtree sizes");
+        int count = static_cast<int>(keys.size());
+        ranks.resize(count);
+        Node *node[kBatchLanes];
+        int which[kBatchLanes];
+        int rank[kBatchLanes];
+        int lanes = 0, next = 0;
+        for (; lanes < kBatchLanes && next < count; lanes++, next++) {
+            node[lanes] = root;
+            which[lanes] = next;
+            rank[lanes] = 0;
+        }
+        while (lanes) {
+            for (int lane = 0; lane < lanes;) {
+                Node *current = node[lane];
+                const Key &key = keys[which[lane]];
+                int result = -1;
+                if (current) {
+                    if (Less(key, current->key)) {
+                        current = current->left_son;
+                    } else {
+                        int before = rank[lane] + (current->left_son ? current->left_son->additional_info : 0);
+                        if (Equal(key, current->key)) {
+                            if (!Augment::Dead(current)) result = before + 1;
+                            current = nullptr;
+                        } else {
+                            rank[lane] = before + Augment::Copies(current);
+                            current = current->right_son;
+                        }
+                    }
+                    if (current) {
+                        PrefetchNode(current);
+                        node[lane++] = current;
+                        continue;
+                    }
+                }
+                ranks[which[lane]] = result;
+                if (!NextBatchSearch(next, count, lanes, lane, node, which)) {
+                    rank[lane] = rank[lanes]; // the last lane moved here.
+                    continue;
+                }
+                rank[lane++] = 0;
+            }
+        }
+    }
+    //*********************************************************************
+    /**
+     * Select for many indices at once, in lockstep like FindBatch.
+     * @param indices - index(+1) in sorted order, as in Select.
+     * @param results - resized to the number of indices. results[i] is Select(indices[i]).
+     */
+    void SelectBatch(const std::vector<int> &indices, std::vector<Node *> &results) {
+        static_assert(Augment::kHasSize, "SelectBatch needs an augmentation that keeps the subtree sizes");
+        int count = static_cast<int>(indices.size());
+        results.resize(count);
+        Node *node[kBatchLanes];
+        int which[kBatchLanes];
+        int index[kBatchLanes];
+        int lanes = 0, next = 0;
+        for (; lanes < kBatchLanes && next < count; lanes++, next++) {
+            node[lanes] = root;
+            which[lanes] = next;
+            index[lanes] = indices[next];
+        }
+        while (lanes) {
+            for (int lane = 0; lane < lanes;) {
+                Node *current = node[lane];
+                if (current) {
+                    int left_size = current->left_son ? current->left_son->additional_info : 0;
+                    int self = Augment::Copies(current);
+                    if (index[lane] <= left_size || index[lane] > left_size + self) {
+                        if (index[lane] <= left_size) {
+                            current = current->left_son;
+                        } else {
+                            index[lane] = index[lane] - left_size - self;
+                            current = current->right_son;
+                        }
+                        if (current) {
+                            PrefetchNode(current);
+                            node[lane++] = current;
+                            continue;
+                        }
+                    }
+                }
+                results[which[lane]] = current;
+                if (!NextBatchSearch(next, count, lanes, lane, node, which)) {
+                    index[lane] = index[lanes];
+                    continue;
+                }
+                index[lane] = indices[which[lane]];
+                lane++;
+            }
+        }
+    }
+    //*********************************************************************
+    /**
+     * the number of searches a batch walks down together: enough to cover the latency of a cache miss, not more
+     * than the misses a core can have in flight.
+     */
+    static const int kBatchLanes = 16;
+
+    static void PrefetchNode(const Node *node) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(node);
+        __builtin_prefetch(&node->right_son); // a node may cross into the next cache line.
+#else
+        (void)node;
+#endif
+    }
+    //*********************************************************************
+    /**
+     * the search in the received lane of a batch ended: the lane goes to the next key, or, if no key is left, the
+     * last lane is moved into it.
+     * @return true if the lane got a new key.
+     */
+    bool NextBatchSearch(int &next, int count, int &lanes, int lane, Node **node, int *which) {
+        if (next < count) {
+            node[lane] = root;
+            which[lane] = next++;
+            return true;
+        }
+        lanes--;
+        node[lane] = node[lanes];
+        which[lane] = which[lanes];
+        return false;
+    }
+    //*********************************************************************
+    /**
+     * returns the aggregate of the values whose keys are in [low, high], in key order, in O(log n).
+     * descends to the first node inside the range, then walks down both borders of the range: every node on the
+     * left border that is inside the range brings its right subtree with it, and the other way around.
+     * only with a SubtreeAggregate augmentation (SubtreeSum, SubtreeMin, SubtreeMax...).
+     * @param low
+     * @param high
+     * @return the aggregate, or the monoid's identity if no key is in the range.
+     */
+    template<class A = Augment>
+    typename A::value_type RangeAggregate(KeyArg low, KeyArg high) {
+        typedef typename Augment::Monoid M;
+        Node *split = root;
+        while (split && (Less(split->key, low) || Less(high, split->key))) {
+            split = Less(split->key, low) ? split->right_son : split->left_son;
+        }
+        if (!split) return M::Identity();
+        typename Augment::value_type left = M::Identity();
+        for (Node *current = split->left_son; current;) {
+            if (!Less(current->key, low)) {
+                left = M::Combine(M::Combine(Augment::Lift(current), Augment::Aggregate(current->right_son)), left);
                 current = current->left_son;
-            } else if (current->left_son && current->left_son->additional_info == (index - 1) || index == 1) {
-                return current;
-            } else if (current->right_son) {
-                index = index - (current->left_son->additional_info) - 1;
+            } else {
                 current = current->right_son;
             }
         }
+        typename Augment::value_type right = M::Identity();
+        for (Node *current = split->right_son; current;) {
+            if (!Less(high, current->key)) {
+                right = M::Combine(right, M::Combine(Augment::Aggregate(current->left_son), Augment::Lift(current)));
+                current = current->right_son;
+            } else {
+                current = current->left_son;
+            }
+        }
+        return M::Combine(M::Combine(left, Augment::Lift(split)), right);
     }
     //*********************************************************************
     /**
      * prints the tree for graphic visualisation
+     * @param out - the stream to print to, the tree itself never writes to the console.
      * @param ptr - root of the subtree to be printed.
      * @param level
      */
-    void print_tree(AVLNode<T> *ptr, const int &level) {
+    void print_tree(std::ostream &out, Node *ptr, const int &level) {
         if (ptr != nullptr) {
-            print_tree(ptr->right_son, level + 1);
-            std::cout << std::endl;
+            print_tree(out, ptr->right_son, level + 1);
+            out << '\n';
             if (ptr == this->root) {
-                std::cout << "Root->";
+                out << "Root->";
             }
             for (int i = 0; i < level && ptr != root; i++)
-                std::cout << "   ";
-            std::cout << ptr->key << "(" << ptr->additional_info << ")";;
-            print_tree(ptr->left_son, level + 1);
+                out << "   ";
+            out << ptr->key << "(" << ptr->additional_info << ")";
+            print_tree(out, ptr->left_son, level + 1);
         }
     }
     //*********************************************************************
@@ -166,64 +604,74 @@ public:
      * clears the tree by doing a post-order traversal and deleting the nodes.
      * @param node - the root of the subtree to be cleared.
      */
-    void ClearTree(AVLNode<T> *node) {
+    void ClearTree(Node *node) {
         if (!node) return;
         ClearTree(node->left_son);
         ClearTree(node->right_son);
-        delete node;
+        DestroyNode(node);
+    }
+    //*********************************************************************
+    /**
+     * runs the destructors of the nodes in the subtree without giving their storage back one by one.
+     * only used right before the allocator releases everything at once.
+     * @param node - the root of the subtree.
+     */
+    void DestructTree(Node *node) {
+        if (!node) return;
+        DestructTree(node->left_son);
+        DestructTree(node->right_son);
+        node->~Node();
     }
     //*********************************************************************
     /**
      * the AVL Tree Destructor. clears all the nodes and resets the tree fields.
+     * if the allocator can release all its nodes at once, the nodes are only destructed (for the
+     * destructors of their values) and the slabs are freed together. trivially destructible nodes are not visited at all.
+     * (if the storage is shared with another tree after a Split or a Join, the nodes are given back one by one)
      */
 
     ~AVLTree() {
-        ClearTree(root);
+        if (Allocator<Node>::kBulkRelease && allocator.IsExclusive()) {
+            if (!std::is_trivially_destructible<Node>::value) {
+                DestructTree(root);
+            }
+        } else {
+            ClearTree(root);
+        }
+        allocator.ReleaseAll();
+        root = nullptr;
         size = 0;
         additional_info_for_tree = -1;
         // make sure that the root is also cleared.
     }
     //*********************************************************************
+    /**
+     * returns the height of the subtree, where an empty subtree has a height of -1.
+     * @param node
+     */
+    int Height(const Node *node) {
+        return node ? node->height : -1;
+    }
+    //*********************************************************************
     /**
      * updates the height and the balance factor of the received node.
+     * only touches the node itself, so it is safe to call on disjoint subtrees from different threads.
      * @param node
      */
-    void UpdateBalance(AVLNode<T> *node) {
-        AVLNode<T> *left = node->left_son;
-        AVLNode<T> *right = node->right_son;
-        if (left && right) {
-            node->height = max(left->height, right->height) + 1;
-            node->balance_factor = (left->height) - (right->height);
-        } else if (left) {
-            node->height = left->height + 1;
-            node->balance_factor += 1;
-        } else if (right) {
-            node->height = right->height + 1;
-            node->balance_factor -= 1;
-        } else { // it's a leaf
-            node->height = 0;
-            node->balance_factor = 0;
-        }
-        if (!(node->parent)) {
-            root = node;
-        }
+    void UpdateBalance(Node *node) {
+        int left_height = Height(node->left_son);
+        int right_height = Height(node->right_son);
+        node->height = max(left_height, right_height) + 1;
+        node->balance_factor = left_height - right_height;
     }
     //*********************************************************************
     /**
-     * updates the "additional_info" field in the received node. (in this case, the size of the subtree)
+     * updates the augmentation fields of the received node (by default additional_info, the size of the subtree)
+     * and then its height and balance factor.
      * @param node
      */
-    // in this case the info is the size of the subtree of the node
-    void UpdateInfo(AVLNode<T> *node) {
-        AVLNode<T> *left = node->left_son;
-        AVLNode<T> *right = node->right_son;
-        if (left && right) {
-            node->additional_info = left->additional_info + right->additional_info + 1;
-        } else if (left && !right) {
-            node->additional_info = left->additional_info + 1;
-        } else if (!left && right) {
-            node->additional_info = right->additional_info + 1;
-        } else node->additional_info = 1;
+    void UpdateInfo(Node *node) {
+        Augment::Update(node);
         UpdateBalance(node);
     }
     //*********************************************************************
@@ -233,8 +681,8 @@ public:
      * VARIABLE B - the node with the balance factor of 1.(the B node in the mevne tutorial slide)
      * @return
      */
-    AVLNode<T> *LeftRotate(AVLNode<T> *node) {
-        AVLNode<T> *B = node->right_son;
+    Node *LeftRotate(Node *node) {
+        Node *B = node->right_son;
         B->parent = node->parent;
         node->right_son = B->left_son;
         if (node->right_son != nullptr) {
@@ -263,8 +711,8 @@ public:
      * VARIABLE A - the node with the balance factor of 1.(A node in the mevne tutorial slide)
      * @return
      */
-    AVLNode<T> *RightRotate(AVLNode<T> *node) {
-        AVLNode<T> *A = node->left_son;
+    Node *RightRotate(Node *node) {
+        Node *A = node->left_son;
         A->parent = node->parent;
         node->left_son = A->right_son;
 
@@ -293,7 +741,7 @@ public:
      * @param node - the node with a balance factor of 2 or -2.
      * @return
      */
-    AVLNode<T> *LRRotate(AVLNode<T> *node) {
+    Node *LRRotate(Node *node) {
         node->left_son = LeftRotate(node->left_son);
         return RightRotate(node);
     }
@@ -303,30 +751,73 @@ public:
      * @param node - the node with a balance factor of 2 or -2.
      * @return
      */
-    AVLNode<T> *RLRotate(AVLNode<T> *node) {
+    Node *RLRotate(Node *node) {
         node->right_son = RightRotate(node->right_son);
         return LeftRotate(node);
     }
     //*********************************************************************
     /**
-     * recursively updates the height and balance factor of the given node and up, and performs the necessary rotations.
+     * refreshes only the augmentation fields from the received node up to the root, for the part of the path above
+     * the point where the heights stopped changing. does nothing if the augmentation keeps no fields.
      * @param node
+     * @return the number of refreshed nodes.
      */
-    void UpdateBalanceAndFix(AVLNode<T> *node) { // checks for the current subtree if it's balanced, and if not, then fix it.
-        if (!node) return;
-        UpdateInfo(node);
-        AVLNode<T> *stam = nullptr;
-        switch (node->balance_factor) {
-            case (2) :
-                (node->left_son && node->left_son->balance_factor >= 0) ? stam = RightRotate(node) : stam = LRRotate(
-                        node);
-                break;
-            case (-2) :
-                (node->right_son && node->right_son->balance_factor <= 0) ? stam = LeftRotate(node) : stam = RLRotate(
-                        node);
-                break;
+    int UpdatePathInfo(Node *node) {
+        if (std::is_empty<typename Augment::Data>::value) return 0;
+        int steps = 0;
+        while (node) {
+            Augment::Update(node);
+            steps++;
+            node = node->parent;
+        }
+        return steps;
+    }
+    //*********************************************************************
+    /**
+     * walks up from the received node (the parent of the node that was added or removed), updates the height and
+     * balance factor of every node on the way and performs the necessary rotations. it stops as soon as the height
+     * of a subtree did not change, since nothing above it can change then (after an insert that happens at the
+     * latest right after the first rotation). the rest of the path only gets its augmentation fields refreshed.
+     * @param node
+     */
+    void UpdateBalanceAndFix(Node *node) { // checks for the current subtree if it's balanced, and if not, then fix it.
+        int retrace_steps = 0;
+        while (node) {
+            int old_height = node->height;
+            UpdateInfo(node);
+            retrace_steps++;
+            Node *stam = node;
+            switch (node->balance_factor) {
+                case (2) :
+                    if (node->left_son->balance_factor >= 0) {
+                        stam = RightRotate(node);
+                        instrument.OnRotation(RotationKind::kRight);
+                    } else {
+                        stam = LRRotate(node);
+                        instrument.OnRotation(RotationKind::kLeftRight);
+                    }
+                    break;
+                case (-2) :
+                    if (node->right_son->balance_factor <= 0) {
+                        stam = LeftRotate(node);
+                        instrument.OnRotation(RotationKind::kLeft);
+                    } else {
+                        stam = RLRotate(node);
+                        instrument.OnRotation(RotationKind::kRightLeft);
+                    }
+                    break;
+            }
+            // stam is the root of the fixed subtree, if it has no parent it's the new root of the tree.
+            if (!(stam->parent)) {
+                root = stam;
+            }
+            node = stam->parent;
+            if (stam->height == old_height) break;
         }
-        UpdateBalanceAndFix(node->parent);
+        bool reached_root = !node;
+        int info_steps = UpdatePathInfo(node);
+        instrument.OnRetrace(retrace_steps, info_steps, reached_root);
+        instrument.OnHeight(Height(root));
     }
     //*********************************************************************
     /**
@@ -334,213 +825,1610 @@ public:
      * @param key
      * @return a pointer to the node, else, nullptr.
      */
-    AVLNode<T> *find(int key) {
+    Node *find(KeyArg key) {
+        typename Instrument::Scope scope(instrument, TreeOp::kFind);
+        return FindNode(key);
+    }
+
+    // a lookup with another key type, with a transparent comparator: a std::string_view in a tree of std::string
+    // keys with std::less<>, without making a std::string.
+    template<class K, class = TransparentKey<K> >
+    Node *find(const K &key) {
+        typename Instrument::Scope scope(instrument, TreeOp::kFind);
+        return FindNode(key);
+    }
+    //*********************************************************************
+    /**
+     * the descent of find, without timing it as a find. (for the operations that start with one)
+     */
+    template<class K>
+    Node *FindNode(const K &key) {
         if (!root) {
             return nullptr;
         }
-        AVLNode<T> *current = root;
+        Node *current = root;
+        int path = 1;
         while (true) {
-            if (key < current->key && current->left_son) {
+            if (Less(key, current->key) && current->left_son) {
                 current = current->left_son;
+                path++;
                 continue;
-            } else if (key > current->key && current->right_son) {
+            } else if (Less(current->key, key) && current->right_son) {
                 current = current->right_son;
+                path++;
                 continue;
-            } else if (key == current->key) {
-                return current;
-            } else return nullptr;
+            }
+            instrument.OnSearch(path);
+            return Equal(key, current->key) && !Augment::Dead(current) ? current : nullptr;
         }
     }
     //*********************************************************************
     /**
-     * given a key and a value, find the place that the new node should take, create one and add it.
-     * @param key
-     * @param value
+     * the node with the smallest key in the subtree.
      */
-    void AddNode(int key, T *value) {
-        AVLNode<T> *current = root;
-        if (root == nullptr) {
-            root = new AVLNode<T>(key, value);
-            size++;
-            // NOTE: update info here (like additional_info_for_tree) if needed before exiting.
-            return;
+    static Node *Minimum(Node *node) {
+        if (!node) return nullptr;
+        while (node->left_son) node = node->left_son;
+        return node;
+    }
+    //*********************************************************************
+    /**
+     * the node with the biggest key in the subtree.
+     */
+    static Node *Maximum(Node *node) {
+        if (!node) return nullptr;
+        while (node->right_son) node = node->right_son;
+        return node;
+    }
+    //*********************************************************************
+    /**
+     * the next node in key order, or nullptr. either the smallest node of the right subtree, or the first ancestor
+     * that has the node in its left subtree. (amortized O(1) when walking the whole tree)
+     */
+    static Node *Successor(Node *node) {
+        if (node->right_son) return Minimum(node->right_son);
+        while (node->parent && node == node->parent->right_son) {
+            node = node->parent;
         }
-            // NOTE:if you need to update the additional_tree_info field, add a line here. or at the end of the function.
-        else
-            while (true) {
-                // before going left, check that there is a node, if not, update it to point to the new_node.
-                if (key < current->key) {
-                    if (current->left_son) {
-                        current = current->left_son;
-                    } else { // if the current node is a leaf with empty left son, add the new node there.
-                        AVLNode<T> *new_node = new AVLNode<T>(key, value);
-                        current->left_son = new_node;
-                        new_node->parent = current;
-                        break;
-                    }
-                }
-                    // before going right, check that there is a node, if not, update it to point to the new_node.
-                else if (key > current->key) {
-                    if (current->right_son) {
-                        current = current->right_son;
-                    } else { // if the current node is a leaf with empty right son
-                        AVLNode<T> *new_node = new AVLNode<T>(key, value);
-                        current->right_son = new_node;
-                        new_node->parent = current;
-                        break;
-                    }
-                } else if (key == current->key) {
-                    cout
-                            << "this message is received from the AddNode function because the keys of the nodes matched, you decide what to do here in the future"
-                            << endl;
-                    return;
-                }
-            }
-        // at this point, the current node is the parent of the new node ( or in case of equality, current = new)
-        size++;
-        UpdateBalanceAndFix(current);
+        return node->parent;
+    }
+    //*********************************************************************
+    /**
+     * the previous node in key order, or nullptr.
+     */
+    static Node *Predecessor(Node *node) {
+        if (node->left_son) return Maximum(node->left_son);
+        while (node->parent && node == node->parent->left_son) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+    //*********************************************************************
+    /**
+     * the received node if it is live, or the next (previous) live node in key order. the iterators skip the
+     * tombstones with these. (without lazy deletion they return the node right away)
+     */
+    static Node *SkipTombstones(Node *node) {
+        while (node && Augment::Dead(node)) node = Successor(node);
+        return node;
+    }
+
+    static Node *SkipTombstonesBack(Node *node) {
+        while (node && Augment::Dead(node)) node = Predecessor(node);
+        return node;
     }
     //*********************************************************************
     /**
-     * given a random and a leaf node, the function switches between them by adjusting their pointers.
+     * a bidirectional iterator over the nodes of the tree in key order. it stays valid as long as the node it points
+     * at is in the tree. the end iterator holds no node, decrementing it goes to the biggest key.
      */
-    AVLNode<T> *SwitchNodeWithLeaf(AVLNode<T> *matching_node, AVLNode<T> *leaf_node) {
-        // in case the matching node is also a leaf node:
-        if (!(matching_node->right_son) && !(matching_node->left_son)) {
-            return matching_node;
+    class iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Node value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Node *pointer;
+        typedef Node &reference;
+
+        iterator() : node(nullptr), tree(nullptr) {}
+
+        iterator(Node *node, AVLTree *tree) : node(node), tree(tree) {}
+
+        Node &operator*() const {
+            return *node;
+        }
+
+        Node *operator->() const {
+            return node;
+        }
+
+        Node *get() const {
+            return node;
+        }
+
+        iterator &operator++() {
+            node = SkipTombstones(Successor(node));
+            return *this;
         }
-        AVLNode<T> **matching_parent = &(matching_node->parent);
-        AVLNode<T> **leaf_parent = &(leaf_node->parent);
-        // if node to be deleted is the root:
-        if (!(matching_node->parent)) {
-            matching_node->parent = leaf_node->parent;
-            leaf_node->parent = nullptr;
-            leaf_node->parent->left_son = matching_node;
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
         }
-            // if the node to be deleted is a right son:
-        else if (matching_node == (*matching_parent)->right_son) {
-            // ********* switching pointers with parents
-            matching_node->parent->right_son = leaf_node;
-            leaf_node->parent->left_son = matching_node;
-            matching_node->parent = (*leaf_parent);
-            leaf_node->parent = (*matching_parent);
+
+        iterator &operator--() {
+            node = SkipTombstonesBack(node ? Predecessor(node) : Maximum(tree->root));
+            return *this;
         }
-            // if the node to be deleted is a left son:
-        else if (matching_node == (*matching_parent)->left_son) {
-            // ********* switching pointers with parents
-            matching_node->parent->left_son = leaf_node;
-            leaf_node->parent->left_son = matching_node;
-            matching_node->parent = (*leaf_parent);
-            leaf_node->parent = (*matching_parent);
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
         }
-        //*****************************************************
-        // ********* switching pointers with sons *************
-        leaf_node->right_son = matching_node->right_son;
-        if (matching_node->right_son) {
-            matching_node->right_son->parent = leaf_node;
+
+        bool operator==(const iterator &other) const {
+            return node == other.node;
         }
-        leaf_node->left_son = matching_node->left_son;
-        if (matching_node->left_son) {
-            matching_node->left_son->parent = leaf_node;
+
+        bool operator!=(const iterator &other) const {
+            return node != other.node;
         }
-        matching_node->left_son = nullptr;
-        matching_node->right_son = nullptr;
-        return matching_node;
+
+    private:
+        Node *node;
+        AVLTree *tree;
+    };
+    //*********************************************************************
+    iterator begin() {
+        return iterator(SkipTombstones(Minimum(root)), this);
+    }
+
+    iterator end() {
+        return iterator(nullptr, this);
     }
     //*********************************************************************
     /**
-     * given a key, find the matching node and remove it. if the additional info (copies of node) is over 1, then decrease it without deleting the node.
+     * the first node with a key bigger or equal to the received key, or nullptr.
      * @param key
-     * @param value
-     */
-    void RemoveNode(int key) {
-        AVLNode<T> *current = root;
-        AVLNode<T> *matching_node = nullptr;
-        AVLNode<T> *leaf_node = nullptr;
-        if (root == nullptr) return;
-            // search for the matching node
-        else
-            while (true) {
-                // before going left, check that there is a node, if not, return.
-                if (key < current->key) {
-                    if (current->left_son) {
-                        current = current->left_son;
-                    } else return;
-                }
-                    // before going right, check that there is a node, if not, return.
-                else if (key > current->key) {
-                    if (current->right_son) {
-                        current = current->right_son;
-                    } else return;
-                } else if (key == current->key) {
-                    matching_node = current;
-                    break;
-                }
-            }
-        // now look for the inorder successor of the matching node. (one right and all the way down to the left)
-        AVLNode<T> *parent = matching_node->parent;
-        bool need_to_switch = false;
-        if (matching_node->right_son) {
-            need_to_switch = true;
-            current = current->right_son;
-            while (current->left_son) {
+     */
+    template<class K>
+    Node *LowerBoundNode(const K &key) {
+        Node *current = root;
+        Node *candidate = nullptr;
+        int path = 0;
+        while (current) {
+            path++;
+            if (Less(current->key, key)) {
+                current = current->right_son;
+            } else {
+                candidate = current;
                 current = current->left_son;
             }
-            leaf_node = current;
-        }
-        if (need_to_switch) {
-            AVLNode<T> *to_delete = SwitchNodeWithLeaf(matching_node, leaf_node);
-            parent = to_delete->parent;
-            if (parent->right_son && parent->right_son == to_delete) parent->right_son = nullptr;
-            if (parent->left_son && parent->left_son == to_delete) parent->left_son = nullptr;
-            delete to_delete;
-            UpdateBalanceAndFix(parent);
-        } else {
-            if (parent && parent->right_son && parent->right_son == matching_node) parent->right_son = nullptr;
-            if (parent && parent->left_son && parent->left_son == matching_node) parent->left_son = nullptr;
-            if (root == matching_node) root = nullptr;
-            delete matching_node;
-            UpdateBalanceAndFix(parent);
         }
-        size--;
+        instrument.OnSearch(path);
+        return candidate;
     }
     //*********************************************************************
     /**
-     * performs an in-order traversal and performs the necessary action along the way.
-     * @param node - the current node.
+     * the first node with a key bigger than the received key, or nullptr.
+     * @param key
      */
-    int InOrderTraversal(AVLNode<T> *node, int *arr, int size, int index = 0) {
-        if (!node) return index;
-        index = InOrderTraversal(node->left_son, arr, size, index);
-        // do something;
-        cout << node->key << endl;
-        if (index >= size) return index;
-        arr[index++] = node->key;
-        return InOrderTraversal(node->right_son, arr, size, index);
+    template<class K>
+    Node *UpperBoundNode(const K &key) {
+        Node *current = root;
+        Node *candidate = nullptr;
+        int path = 0;
+        while (current) {
+            path++;
+            if (!Less(key, current->key)) {
+                current = current->right_son;
+            } else {
+                candidate = current;
+                current = current->left_son;
+            }
+        }
+        instrument.OnSearch(path);
+        return candidate;
+    }
+    //*********************************************************************
+    iterator lower_bound(KeyArg key) {
+        return iterator(SkipTombstones(LowerBoundNode(key)), this);
+    }
+
+    template<class K, class = TransparentKey<K> >
+    iterator lower_bound(const K &key) {
+        return iterator(SkipTombstones(LowerBoundNode(key)), this);
+    }
+
+    iterator upper_bound(KeyArg key) {
+        return iterator(SkipTombstones(UpperBoundNode(key)), this);
+    }
+
+    template<class K, class = TransparentKey<K> >
+    iterator upper_bound(const K &key) {
+        return iterator(SkipTombstones(UpperBoundNode(key)), this);
+    }
+    //*********************************************************************
+    /**
+     * the nodes with keys in [low, high], found lazily: only the first one is searched for, and every step after it
+     * moves to the successor and stops as soon as a key is bigger than high. works with a range-for, and the
+     * iterators can be kept to continue a scan later (as long as their node is still in the tree).
+     */
+    class KeyRange {
+    public:
+        class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef Node value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef Node *pointer;
+            typedef Node &reference;
+
+            iterator() : node(nullptr), high() {}
+
+            iterator(Node *node, KeyArg high) : node(node), high(high) {}
+
+            Node &operator*() const {
+                return *node;
+            }
+
+            Node *operator->() const {
+                return node;
+            }
+
+            iterator &operator++() {
+                node = SkipTombstones(Successor(node));
+                if (node && Less(high, node->key)) node = nullptr;
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator old = *this;
+                ++*this;
+                return old;
+            }
+
+            bool operator==(const iterator &other) const {
+                return node == other.node;
+            }
+
+            bool operator!=(const iterator &other) const {
+                return node != other.node;
+            }
+
+        private:
+            Node *node;
+            Key high;
+        };
+
+        KeyRange(Node *first, KeyArg high) : first(first), high(high) {}
+
+        iterator begin() const {
+            return iterator(first, high);
+        }
+
+        iterator end() const {
+            return iterator(nullptr, high);
+        }
+
+        bool empty() const {
+            return first == nullptr;
+        }
+
+    private:
+        Node *first;
+        Key high;
+    };
+    //*********************************************************************
+    /**
+     * a lazy view of the nodes with keys in [low, high], in key order.
+     * @param low
+     * @param high
+     */
+    KeyRange range(KeyArg low, KeyArg high) {
+        Node *first = SkipTombstones(LowerBoundNode(low));
+        if (first && Less(high, first->key)) first = nullptr;
+        return KeyRange(first, high);
+    }
+    //*********************************************************************
+    /**
+     * given a key and the arguments of a value, find the place that the new node should take, create one (with the
+     * value constructed in place) and add it. nothing is constructed if the key is already there, in a multiset
+     * (SubtreeMultiplicity) the node of the key gets one more copy instead.
+     * in finger mode, a key that falls right next to the last added key is added there without a search.
+     * @param key
+     * @param args - the arguments of T's constructor.
+     * @return the node with the key, and true if it was added (false if the key was already there).
+     */
+    template<class... Args>
+    std::pair<Node *, bool> Emplace(KeyArg key, Args &&... args) {
+        return CountCopy(TryEmplace(key, std::forward<Args>(args)...));
+    }
+    //*********************************************************************
+    /**
+     * Emplace without the copies, under the name of std::map::try_emplace: one descent, and the value is only
+     * constructed from the arguments if the key is added. a key that is there is left as it is, in a multiset too.
+     * @return the node with the key, and true if it was added.
+     */
+    template<class... Args>
+    std::pair<Node *, bool> TryEmplace(KeyArg key, Args &&... args) {
+        typename Instrument::Scope scope(instrument, TreeOp::kAddNode);
+        if (finger_mode && finger) {
+            if (Equal(key, finger->key)) return EmplaceExisting(finger, std::forward<Args>(args)...);
+            Node *new_node = Less(finger->key, key) ? EmplaceBetween(finger, finger_next, key, std::forward<Args>(args)...)
+                                               : EmplaceBetween(finger_prev, finger, key, std::forward<Args>(args)...);
+            if (new_node) return std::make_pair(new_node, true);
+        }
+        return EmplaceFromRoot(key, std::forward<Args>(args)...);
+    }
+    //*********************************************************************
+    /**
+     * the same as Emplace, with a hint of where the key goes, as in std::map::emplace_hint: if the key falls between
+     * the hint and the node before it, it is added there without a search from the root. otherwise it is added
+     * like Emplace. (the finger is not tried)
+     * @param hint - the first node after the key, or nullptr (end()) for a key bigger than all the others.
+     * @param key
+     * @param args - the arguments of T's constructor.
+     */
+    template<class... Args>
+    std::pair<Node *, bool> EmplaceHint(Node *hint, KeyArg key, Args &&... args) {
+        typename Instrument::Scope scope(instrument, TreeOp::kAddNode);
+        Node *before = hint ? Predecessor(hint) : Maximum(root);
+        if (hint && Equal(key, hint->key)) return CountCopy(EmplaceExisting(hint, std::forward<Args>(args)...));
+        if (before && Equal(key, before->key)) return CountCopy(EmplaceExisting(before, std::forward<Args>(args)...));
+        Node *new_node = EmplaceBetween(before, hint, key, std::forward<Args>(args)...);
+        if (new_node) return std::make_pair(new_node, true);
+        return CountCopy(EmplaceFromRoot(key, std::forward<Args>(args)...));
+    }
+
+    template<class... Args>
+    std::pair<Node *, bool> EmplaceHint(iterator hint, KeyArg key, Args &&... args) {
+        return EmplaceHint(hint.get(), key, std::forward<Args>(args)...);
+    }
+    //*********************************************************************
+    /**
+     * turns the finger on or off. the tree always remembers where the last key was added (the finger, with the
+     * nodes before and after it), in finger mode Emplace and AddNode try that spot before searching from the root.
+     * a stream of increasing (or decreasing) keys is then added in amortized O(1): no search, and the retrace
+     * stops early.
+     */
+    void SetFingerMode(bool enabled) {
+        finger_mode = enabled;
+    }
+    //*********************************************************************
+    /**
+     * the descent of Emplace from the root. it remembers the last nodes it passed on the left and on the right of
+     * the key, which are the nodes before and after the new node, for the finger.
+     */
+    template<class... Args>
+    std::pair<Node *, bool> EmplaceFromRoot(KeyArg key, Args &&... args) {
+        Node *current = root;
+        Node *new_node = nullptr;
+        Node *before = nullptr, *after = nullptr;
+        int path = 0;
+        if (root == nullptr) {
+            root = CreateNode(key, std::forward<Args>(args)...);
+            size++;
+            SetFinger(root, nullptr, nullptr);
+            leftmost = rightmost = root;
+            // NOTE: update info here (like additional_info_for_tree) if needed before exiting.
+            return std::make_pair(root, true);
+        }
+            // NOTE:if you need to update the additional_tree_info field, add a line here. or at the end of the function.
+        else
+            while (true) {
+                path++;
+                // before going left, check that there is a node, if not, update it to point to the new_node.
+                if (Less(key, current->key)) {
+                    after = current;
+                    if (current->left_son) {
+                        current = current->left_son;
+                    } else { // if the current node is a leaf with empty left son, add the new node there.
+                        new_node = CreateNode(key, std::forward<Args>(args)...);
+                        current->left_son = new_node;
+                        new_node->parent = current;
+                        break;
+                    }
+                }
+                    // before going right, check that there is a node, if not, update it to point to the new_node.
+                else if (Less(current->key, key)) {
+                    before = current;
+                    if (current->right_son) {
+                        current = current->right_son;
+                    } else { // if the current node is a leaf with empty right son
+                        new_node = CreateNode(key, std::forward<Args>(args)...);
+                        current->right_son = new_node;
+                        new_node->parent = current;
+                        break;
+                    }
+                } else { // the same key.
+                    instrument.OnSearch(path);
+                    return EmplaceExisting(current, std::forward<Args>(args)...);
+                }
+            }
+        // at this point, the current node is the parent of the new node ( or in case of equality, current = new)
+        instrument.OnSearch(path);
+        size++;
+        UpdateBalanceAndFix(current);
+        SetFinger(new_node, before, after);
+        if (!before) leftmost = new_node;
+        if (!after) rightmost = new_node;
+        return std::make_pair(new_node, true);
+    }
+    //*********************************************************************
+    /**
+     * adds the key between two nodes that are next to each other in key order, without a search: the new node
+     * becomes the right son of before, or if that one is taken, the left son of after (the first node of the right
+     * subtree of before, so it has no left son). nothing is constructed if the key is not strictly between them.
+     * @param before, after - either may be nullptr, for the ends of the tree.
+     * @return the new node, or nullptr if the key does not go between them.
+     */
+    template<class... Args>
+    Node *EmplaceBetween(Node *before, Node *after, KeyArg key, Args &&... args) {
+        if ((before && !Less(before->key, key)) || (after && !Less(key, after->key))) return nullptr;
+        Node *new_node = CreateNode(key, std::forward<Args>(args)...);
+        Node *parent = nullptr;
+        if (before && !before->right_son) {
+            parent = before;
+            before->right_son = new_node;
+        } else if (after) {
+            parent = after;
+            after->left_son = new_node;
+        } else {
+            root = new_node;
+        }
+        new_node->parent = parent;
+        instrument.OnSearch(1);
+        size++;
+        UpdateBalanceAndFix(parent);
+        SetFinger(new_node, before, after);
+        if (!before) leftmost = new_node;
+        if (!after) rightmost = new_node;
+        return new_node;
+    }
+    //*********************************************************************
+    /**
+     * the end of an Emplace that found the key: nothing is constructed, unless the node is a tombstone, which is
+     * brought back to life with the new value.
+     */
+    template<class... Args>
+    std::pair<Node *, bool> EmplaceExisting(Node *node, Args &&... args) {
+        if (!Augment::Dead(node)) return std::make_pair(node, false);
+        node->value = T(std::forward<Args>(args)...);
+        SetDead(node, false);
+        size++;
+        return std::make_pair(node, true);
+    }
+    //*********************************************************************
+    /**
+     * the end of an Emplace: in a multiset, a key that was already there gets one more copy.
+     */
+    std::pair<Node *, bool> CountCopy(std::pair<Node *, bool> result) {
+        if constexpr (Augment::kMultiset) {
+            if (!result.second) AddCopies(result.first, 1);
+        }
+        return result;
+    }
+    //*********************************************************************
+    /**
+     * adds copies of the node's key in a multiset (or removes them, with a negative count, leaving at least one):
+     * only the multiplicity of the node and the copy counts on its way up change, in O(log n) with no allocation
+     * and no rotation.
+     * @param node
+     * @param count
+     */
+    void AddCopies(Node *node, int count) {
+        static_assert(Augment::kMultiset, "AddCopies needs the SubtreeMultiplicity augmentation");
+        node->multiplicity += count;
+        for (Node *current = node; current; current = current->parent) {
+            current->additional_info += count;
+        }
+        size += count;
+    }
+    //*********************************************************************
+    /**
+     * the number of copies of the key: its multiplicity in a multiset, otherwise 1 if it's there. 0 if it's not.
+     * @param key
+     */
+    int Multiplicity(KeyArg key) {
+        Node *node = FindNode(key);
+        return node ? Augment::Copies(node) : 0;
+    }
+
+    template<class K, class = TransparentKey<K> >
+    int Multiplicity(const K &key) {
+        Node *node = FindNode(key);
+        return node ? Augment::Copies(node) : 0;
+    }
+    //*********************************************************************
+    void SetFinger(Node *node, Node *before, Node *after) {
+        finger = node;
+        finger_prev = before;
+        finger_next = after;
+    }
+
+    // after a change that may have moved the keys around the finger.
+    void ForgetFinger() {
+        finger = nullptr;
+    }
+
+    // after a change of many nodes at once: the finger is forgotten and the first and the last nodes are found again.
+    void ResetCachedNodes() {
+        ForgetFinger();
+        leftmost = Minimum(root);
+        rightmost = Maximum(root);
+    }
+    //*********************************************************************
+    /**
+     * given a key and a value, find the place that the new node should take, create one and add it.
+     * a key that is already there is reported to the instrumentation policy (OnDiagnostic), nothing is printed.
+     * in a multiset the key gets one more copy instead. (and the node keeps its value)
+     * @param key
+     * @param value - moved into the node.
+     * @return true if added, false if the key was already there. (the tree's value is kept)
+     */
+    bool AddNode(KeyArg key, T value) {
+        if (Emplace(key, std::move(value)).second || Augment::kMultiset) return true;
+        instrument.OnDiagnostic(TreeDiagnostic::kDuplicateKey, key);
+        return false;
+    }
+    //*********************************************************************
+    /**
+     * adds the key with the received value, or assigns the value to the node if the key is already there, in one
+     * descent. (the find-then-AddNode of an upsert takes two) an assigned value is added to the aggregates of the
+     * path with a SubtreeAggregate augmentation.
+     * @return the node with the key, and true if it was added (false if it was assigned).
+     */
+    template<class M>
+    std::pair<Node *, bool> InsertOrAssign(KeyArg key, M &&value) {
+        std::pair<Node *, bool> result = TryEmplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->value = std::forward<M>(value); // (not moved from: nothing was built)
+            if constexpr (Augment::kUsesValues) UpdatePathInfo(result.first);
+        }
+        return result;
+    }
+    //*********************************************************************
+    /**
+     * the node with the key, added with a default constructed value if it was not there, in one descent.
+     * (like std::map::operator[]) with an augmentation that reads the values (Augment::kUsesValues, the
+     * SubtreeAggregate ones), a caller that changes the value must call UpdatePathInfo(node) afterwards.
+     * @return the node with the key, and true if it was added.
+     */
+    std::pair<Node *, bool> GetOrCreate(KeyArg key) {
+        return TryEmplace(key);
+    }
+    //*********************************************************************
+    /**
+     * given a root of a subtree whose nodes only point down, sets the parent pointer of every node under it.
+     * (the parent of the received node itself is not touched)
+     * @param node - the root of the subtree.
+     */
+    void UpdateParents(Node *node) {
+        if (!node) return;
+        if (node->left_son) {
+            node->left_son->parent = node;
+            UpdateParents(node->left_son);
+        }
+        if (node->right_son) {
+            node->right_son->parent = node;
+            UpdateParents(node->right_son);
+        }
+    }
+    //*********************************************************************
+    /**
+     * builds a perfectly balanced subtree out of the next count (key, value) pairs, the middle pair becomes the
+     * root. the pairs are taken in order, one ++first per node, so the whole build is one pass over the range
+     * whatever the kind of iterator. the height, balance factor and augmentation of every node are set on the way
+     * back up, only the parent pointers are left for UpdateParents.
+     * @param first - the next pair of the range, moved past the count pairs that were used.
+     * @param count - number of pairs in the subtree.
+     * @return the root of the new subtree.
+     */
+    template<class Iterator>
+    Node *BuildBalanced(Iterator &first, int count) {
+        if (count <= 0) return nullptr;
+        int middle = count / 2;
+        Node *left = BuildBalanced(first, middle);
+        Node *node = CreateNode(first->first, std::move(first->second));
+        ++first;
+        node->left_son = left;
+        node->right_son = BuildBalanced(first, count - middle - 1);
+        UpdateInfo(node);
+        return node;
+    }
+    //*********************************************************************
+    /**
+     * replaces the content of the tree with the received pairs in O(n), instead of n calls to AddNode.
+     * the values are moved out of the range, which is gone through twice: once to count it, once to build.
+     * @param first, last - a (forward iterator) range of std::pair<Key, T> sorted by strictly increasing key.
+     */
+    template<class Iterator>
+    void BuildFromSorted(Iterator first, Iterator last) {
+        ClearTree(root);
+        size = static_cast<int>(std::distance(first, last));
+        root = BuildBalanced(first, size);
+        if (root) {
+            root->parent = nullptr;
+            UpdateParents(root);
+        }
+        ResetCachedNodes();
+    }
+    //*********************************************************************
+    /**
+     * replaces the content of the tree with the received pairs. they are sorted in parallel on the received pool,
+     * and if a key appears more than once only one of its pairs is kept.
+     * @param pairs - (key, value) pairs in any order.
+     */
+    void BuildFromUnsorted(std::vector<std::pair<Key, T> > pairs, ThreadPool &pool = DefaultThreadPool()) {
+        typedef std::pair<Key, T> Pair;
+        auto by_key = [](const Pair &a, const Pair &b) { return Less(a.first, b.first); };
+        ParallelSort(pairs.begin(), pairs.end(), by_key, pool);
+        auto write = pairs.begin();
+        for (auto read = pairs.begin(); read != pairs.end(); ++read) {
+            if (write == pairs.begin() || !Equal((write - 1)->first, read->first)) {
+                if (write != read) *write = std::move(*read);
+                ++write;
+            }
+        }
+        pairs.erase(write, pairs.end());
+        BuildFromSorted(pairs.begin(), pairs.end());
+    }
+    //*********************************************************************
+    /**
+     * cuts the node from its parent (only the node's side of the link) and returns it.
+     */
+    Node *Detach(Node *node) {
+        if (node) node->parent = nullptr;
+        return node;
+    }
+    //*********************************************************************
+    /**
+     * makes the pivot the root of the two received subtrees, which must be balanced with each other.
+     * @return the pivot.
+     */
+    Node *Link(Node *left, Node *pivot, Node *right) {
+        pivot->parent = nullptr;
+        pivot->left_son = left;
+        pivot->right_son = right;
+        if (left) left->parent = pivot;
+        if (right) right->parent = pivot;
+        UpdateInfo(pivot);
+        return pivot;
+    }
+    //*********************************************************************
+    /**
+     * joins when the left subtree is the taller one: goes down the right spine of the left subtree to the first
+     * node that is balanced with the right subtree, links it there with the pivot and fixes the way up with
+     * rotations.
+     * @return the root of the joined subtree.
+     */
+    Node *JoinRight(Node *left, Node *pivot, Node *right) {
+        Node *inner = Detach(left->right_son);
+        bool linked = Height(inner) <= Height(right) + 1;
+        Node *joined = linked ? Link(inner, pivot, right) : JoinRight(inner, pivot, right);
+        left->right_son = joined;
+        joined->parent = left;
+        if (Height(joined) <= Height(left->left_son) + 1) {
+            UpdateInfo(left);
+            return left;
+        }
+        if (linked) {
+            RightRotate(joined);
+        }
+        return LeftRotate(left);
+    }
+    //*********************************************************************
+    /**
+     * the mirror of JoinRight, for when the right subtree is the taller one.
+     * @return the root of the joined subtree.
+     */
+    Node *JoinLeft(Node *left, Node *pivot, Node *right) {
+        Node *inner = Detach(right->left_son);
+        bool linked = Height(inner) <= Height(left) + 1;
+        Node *joined = linked ? Link(left, pivot, inner) : JoinLeft(left, pivot, inner);
+        right->left_son = joined;
+        joined->parent = right;
+        if (Height(joined) <= Height(right->right_son) + 1) {
+            UpdateInfo(right);
+            return right;
+        }
+        if (linked) {
+            LeftRotate(joined);
+        }
+        return RightRotate(right);
+    }
+    //*********************************************************************
+    /**
+     * joins two detached subtrees and a pivot node into one balanced subtree in O(|height(left)-height(right)|).
+     * all the keys in left must be smaller than the pivot's key, and all the keys in right bigger.
+     * @return the root of the joined subtree, with no parent.
+     */
+    Node *JoinNodes(Node *left, Node *pivot, Node *right) {
+        Detach(left);
+        Detach(right);
+        if (Height(left) > Height(right) + 1) return JoinRight(left, pivot, right);
+        if (Height(right) > Height(left) + 1) return JoinLeft(left, pivot, right);
+        return Link(left, pivot, right);
+    }
+    //*********************************************************************
+    /**
+     * removes the node with the biggest key from a detached subtree.
+     * @param last - receives the removed node.
+     * @return the root of what's left of the subtree.
+     */
+    Node *SplitLast(Node *node, Node *&last) {
+        Node *left = Detach(node->left_son);
+        Node *right = Detach(node->right_son);
+        if (!right) {
+            last = Link(nullptr, node, nullptr);
+            return left;
+        }
+        Node *rest = SplitLast(right, last);
+        return JoinNodes(left, node, rest);
+    }
+    //*********************************************************************
+    /**
+     * joins two detached subtrees without a pivot, all the keys in left must be smaller than the keys in right.
+     * @return the root of the joined subtree, with no parent.
+     */
+    Node *JoinNodes(Node *left, Node *right) {
+        if (!left) return Detach(right);
+        Node *last = nullptr;
+        Node *rest = SplitLast(left, last);
+        return JoinNodes(rest, last, right);
+    }
+    //*********************************************************************
+    /**
+     * splits a detached subtree by a key in O(log n), the nodes on the search path are re-joined on the side
+     * they belong to.
+     * @param left - receives the subtree of the smaller keys.
+     * @param match - receives the node with the key as a single detached node, or nullptr if there isn't one.
+     * @param right - receives the subtree of the bigger keys.
+     */
+    void SplitNode(Node *node, KeyArg key, Node *&left, Node *&match, Node *&right) {
+        if (!node) {
+            left = match = right = nullptr;
+            return;
+        }
+        Node *left_son = Detach(node->left_son);
+        Node *right_son = Detach(node->right_son);
+        if (Equal(key, node->key)) {
+            left = left_son;
+            match = Link(nullptr, node, nullptr);
+            right = right_son;
+        } else if (Less(key, node->key)) {
+            Node *bigger = nullptr;
+            SplitNode(left_son, key, left, match, bigger);
+            right = JoinNodes(bigger, node, right_son);
+        } else {
+            Node *smaller = nullptr;
+            SplitNode(right_son, key, smaller, match, right);
+            left = JoinNodes(left_son, node, smaller);
+        }
+    }
+    //*********************************************************************
+    /**
+     * moves all the nodes of the right tree into this tree in O(log n). all the keys of the right tree must be
+     * bigger than the keys of this tree. the right tree is left empty.
+     * @param right
+     */
+    void Join(AVLTree &right) {
+        if (&right == this) return;
+        allocator.Share(right.allocator);
+        root = JoinNodes(root, right.root);
+        size += right.size;
+        ResetCachedNodes();
+        right.root = nullptr;
+        right.size = 0;
+        right.ResetCachedNodes();
+    }
+    //*********************************************************************
+    /**
+     * same as Join, with a new node between the keys of this tree and the keys of the right tree.
+     * @param key - bigger than all the keys of this tree and smaller than all the keys of the right tree.
+     * @param value - moved into the new node.
+     * @param right
+     */
+    void Join(KeyArg key, T value, AVLTree &right) {
+        if (&right == this) return;
+        allocator.Share(right.allocator);
+        root = JoinNodes(root, CreateNode(key, std::move(value)), right.root);
+        size += right.size + 1;
+        ResetCachedNodes();
+        right.root = nullptr;
+        right.size = 0;
+        right.ResetCachedNodes();
+    }
+    //*********************************************************************
+    /**
+     * moves all the nodes with a key bigger than the received key into the right tree in O(log n).
+     * whatever the right tree held before is deleted.
+     * @param key
+     * @param right
+     */
+    void Split(KeyArg key, AVLTree &right) {
+        if (&right == this) return;
+        right.ClearTree(right.root);
+        right.allocator.Share(allocator);
+        Node *smaller = nullptr, *match = nullptr, *bigger = nullptr;
+        SplitNode(root, key, smaller, match, bigger);
+        root = match ? JoinNodes(smaller, match, nullptr) : smaller;
+        right.root = bigger;
+        right.size = Augment::Count(bigger);
+        size = size - right.size;
+        ResetCachedNodes();
+        right.ResetCachedNodes();
     }
     //*********************************************************************
     /**
-     * performs an pre-order traversal and performs the necessary action along the way.
+     * the subtrees of the set operations are handled in parallel only if one of them is at least this high
+     * (an AVL tree of height 16 has at least 2583 nodes), smaller ones are not worth a task.
+     */
+    static const int kParallelSetHeight = 16;
+
+    bool WorthForking(const Node *a, const Node *b) {
+        return max(Height(a), Height(b)) >= kParallelSetHeight;
+    }
+    //*********************************************************************
+    /**
+     * the union of two detached subtrees: split a by the root of b, union the halves (in parallel) and join them
+     * back with b's root as the pivot. the nodes left over from equal keys are added to garbage, they are
+     * destroyed later because the allocator is not thread safe.
+     * @return the root of the union.
+     */
+    Node *UnionNodes(Node *a, Node *b, std::vector<Node *> &garbage, ThreadPool &pool) {
+        if (!a) return Detach(b);
+        if (!b) return Detach(a);
+        bool fork = WorthForking(a, b);
+        Node *b_left = Detach(b->left_son);
+        Node *b_right = Detach(b->right_son);
+        Node *a_left = nullptr, *match = nullptr, *a_right = nullptr;
+        SplitNode(a, b->key, a_left, match, a_right);
+        Node *pivot = Link(nullptr, b, nullptr);
+        if (match) { // keep the value that was in a.
+            garbage.push_back(pivot);
+            pivot = match;
+        }
+        Node *left = nullptr, *right = nullptr;
+        if (fork) {
+            std::vector<Node *> left_garbage;
+            ParallelInvoke([&] { left = UnionNodes(a_left, b_left, left_garbage, pool); },
+                           [&] { right = UnionNodes(a_right, b_right, garbage, pool); }, pool);
+            garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+        } else {
+            left = UnionNodes(a_left, b_left, garbage, pool);
+            right = UnionNodes(a_right, b_right, garbage, pool);
+        }
+        return JoinNodes(left, pivot, right);
+    }
+    //*********************************************************************
+    /**
+     * the intersection of a detached subtree with a read-only subtree b. the nodes (and whole subtrees) of a that
+     * are not in b are added to garbage. a tombstone of b is not in b.
+     * @return the root of the intersection.
+     */
+    Node *IntersectionNodes(Node *a, const Node *b, std::vector<Node *> &garbage,
+                                  ThreadPool &pool) {
+        if (!a) return nullptr;
+        if (!b) {
+            garbage.push_back(Detach(a));
+            return nullptr;
+        }
+        bool fork = WorthForking(a, b);
+        Node *a_left = nullptr, *match = nullptr, *a_right = nullptr;
+        SplitNode(a, b->key, a_left, match, a_right);
+        if (match && Augment::Dead(b)) {
+            garbage.push_back(match);
+            match = nullptr;
+        }
+        Node *left = nullptr, *right = nullptr;
+        if (fork) {
+            std::vector<Node *> left_garbage;
+            ParallelInvoke([&] { left = IntersectionNodes(a_left, b->left_son, left_garbage, pool); },
+                           [&] { right = IntersectionNodes(a_right, b->right_son, garbage, pool); }, pool);
+            garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+        } else {
+            left = IntersectionNodes(a_left, b->left_son, garbage, pool);
+            right = IntersectionNodes(a_right, b->right_son, garbage, pool);
+        }
+        return match ? JoinNodes(left, match, right) : JoinNodes(left, right);
+    }
+    //*********************************************************************
+    /**
+     * the difference between a detached subtree and a read-only subtree b. the nodes of a that are also in b are
+     * added to garbage. a tombstone of b removes nothing.
+     * @return the root of the difference.
+     */
+    Node *DifferenceNodes(Node *a, const Node *b, std::vector<Node *> &garbage,
+                                ThreadPool &pool) {
+        if (!a) return nullptr;
+        if (!b) return Detach(a);
+        bool fork = WorthForking(a, b);
+        Node *a_left = nullptr, *match = nullptr, *a_right = nullptr;
+        SplitNode(a, b->key, a_left, match, a_right);
+        if (match && !Augment::Dead(b)) {
+            garbage.push_back(match);
+            match = nullptr;
+        }
+        Node *left = nullptr, *right = nullptr;
+        if (fork) {
+            std::vector<Node *> left_garbage;
+            ParallelInvoke([&] { left = DifferenceNodes(a_left, b->left_son, left_garbage, pool); },
+                           [&] { right = DifferenceNodes(a_right, b->right_son, garbage, pool); }, pool);
+            garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+        } else {
+            left = DifferenceNodes(a_left, b->left_son, garbage, pool);
+            right = DifferenceNodes(a_right, b->right_son, garbage, pool);
+        }
+        return match ? JoinNodes(left, match, right) : JoinNodes(left, right);
+    }
+    //*********************************************************************
+    /**
+     * destroys the leftovers of a set operation and recounts the size of the tree.
+     * (O(1) with the subtree sizes, O(n) with NoAugment)
+     */
+    void FinishSetOperation(std::vector<Node *> &garbage) {
+        for (Node *node : garbage) {
+            ClearTree(node);
+        }
+        size = Augment::Count(root);
+        ResetCachedNodes();
+    }
+    //*********************************************************************
+    /**
+     * moves all the nodes of the other tree into this one, in O(m log(n/m + 1)) work for m <= n.
+     * if a key is in both trees, the value of this tree is kept. the other tree is left empty.
+     * @param other
+     * @param pool - the thread pool that runs the recursion.
+     */
+    void Union(AVLTree &other, ThreadPool &pool = DefaultThreadPool()) {
+        if (&other == this) return;
+        DropTombstones(&pool); // (a tombstone must not win over a live key of the other tree)
+        other.DropTombstones(&pool);
+        allocator.Share(other.allocator);
+        std::vector<Node *> garbage;
+        root = UnionNodes(root, other.root, garbage, pool);
+        other.root = nullptr;
+        other.size = 0;
+        other.ResetCachedNodes();
+        FinishSetOperation(garbage);
+    }
+    //*********************************************************************
+    /**
+     * deletes all the keys of this tree that are not in the other tree. the other tree is not changed.
+     * @param other
+     * @param pool - the thread pool that runs the recursion.
+     */
+    void Intersection(const AVLTree &other, ThreadPool &pool = DefaultThreadPool()) {
+        if (&other == this) return;
+        DropTombstones(&pool);
+        std::vector<Node *> garbage;
+        root = IntersectionNodes(root, other.root, garbage, pool);
+        FinishSetOperation(garbage);
+    }
+    //*********************************************************************
+    /**
+     * deletes all the keys of this tree that are also in the other tree. the other tree is not changed.
+     * @param other
+     * @param pool - the thread pool that runs the recursion.
+     */
+    void Difference(const AVLTree &other, ThreadPool &pool = DefaultThreadPool()) {
+        if (&other == this) {
+            ClearTree(root);
+            root = nullptr;
+            size = 0;
+            ResetCachedNodes();
+            return;
+        }
+        DropTombstones(&pool);
+        std::vector<Node *> garbage;
+        root = DifferenceNodes(root, other.root, garbage, pool);
+        FinishSetOperation(garbage);
+    }
+    //*********************************************************************
+    /**
+     * makes the parent of old_son point at new_son instead (or the root, if old_son was the root).
+     * the parent pointer of new_son is not touched.
+     */
+    void ReplaceSon(Node *parent, Node *old_son, Node *new_son) {
+        if (!parent) {
+            root = new_son;
+        } else if (parent->left_son == old_son) {
+            parent->left_son = new_son;
+        } else {
+            parent->right_son = new_son;
+        }
+    }
+    //*********************************************************************
+    /**
+     * removes the received node, which belongs to this tree, and rebalances. a node with two sons is replaced by its
+     * in-order successor, by moving the successor node itself, so no other node changes its key or value.
+     * @param node
+     */
+    void RemoveNode(Node *node) {
+        if (node == finger || node == finger_prev || node == finger_next) ForgetFinger();
+        if (node == leftmost) leftmost = Successor(node);
+        if (node == rightmost) rightmost = Predecessor(node);
+        Node *retrace_from = nullptr;
+        if (node->left_son && node->right_son) {
+            Node *successor = node->right_son;
+            while (successor->left_son) {
+                successor = successor->left_son;
+            }
+            // unlink the successor (it has no left son), then put it in the place of the removed node.
+            retrace_from = successor->parent == node ? successor : successor->parent;
+            if (successor->right_son) successor->right_son->parent = successor->parent;
+            ReplaceSon(successor->parent, successor, successor->right_son);
+            successor->left_son = node->left_son;
+            successor->right_son = node->right_son;
+            if (successor->left_son) successor->left_son->parent = successor;
+            if (successor->right_son) successor->right_son->parent = successor;
+            successor->parent = node->parent;
+            ReplaceSon(node->parent, node, successor);
+            // the height before the removal, for the retrace that may start at the successor.
+            successor->height = node->height;
+            successor->balance_factor = node->balance_factor;
+        } else {
+            Node *son = node->left_son ? node->left_son : node->right_son;
+            if (son) son->parent = node->parent;
+            ReplaceSon(node->parent, node, son);
+            retrace_from = node->parent;
+        }
+        node->left_son = nullptr;
+        node->right_son = nullptr;
+        size -= Augment::Copies(node); // (0 for a tombstone, all the copies in a multiset)
+        DestroyNode(node);
+        UpdateBalanceAndFix(retrace_from);
+    }
+    //*********************************************************************
+    /**
+     * given a key, find the matching node and remove it. in a multiset only one copy is removed, the node goes
+     * with the last one. (RemoveNode(Node *) removes all of them)
+     * @param key
+     */
+    void RemoveNode(KeyArg key) {
+        typename Instrument::Scope scope(instrument, TreeOp::kRemoveNode);
+        Node *matching_node = FindNode(key);
+        if constexpr (Augment::kMultiset) {
+            if (matching_node && matching_node->multiplicity > 1) {
+                AddCopies(matching_node, -1);
+                return;
+            }
+        }
+        if (matching_node) RemoveNode(matching_node);
+    }
+    //*********************************************************************
+    /**
+     * removes the node with the received key, and moves its value out first.
+     * @param key
+     * @param value - receives the value of the removed node. not touched if the key is not there.
+     * @return true if the key was found.
+     */
+    bool Extract(KeyArg key, T &value) {
+        typename Instrument::Scope scope(instrument, TreeOp::kRemoveNode);
+        Node *matching_node = FindNode(key);
+        if (!matching_node) return false;
+        value = std::move(matching_node->value);
+        RemoveNode(matching_node);
+        return true;
+    }
+    //*********************************************************************
+    /**
+     * the node with the smallest (biggest) key in O(1), or nullptr if the tree is empty. the tree keeps the two
+     * nodes at the ends up to date through every change. (with tombstones, the first live one from that end)
+     */
+    Node *PeekMin() {
+        return SkipTombstones(leftmost);
+    }
+
+    Node *PeekMax() {
+        return SkipTombstonesBack(rightmost);
+    }
+    //*********************************************************************
+    /**
+     * removes the node with the smallest (biggest) key, without searching for it, and moves its key and value out.
+     * @return false if the tree is empty. (key and value are not touched then)
+     */
+    bool PopMin(Key &key, T &value) {
+        return PopNode(PeekMin(), key, value);
+    }
+
+    bool PopMax(Key &key, T &value) {
+        return PopNode(PeekMax(), key, value);
+    }
+
+    bool PopNode(Node *node, Key &key, T &value) {
+        typename Instrument::Scope scope(instrument, TreeOp::kRemoveNode);
+        if (!node) return false;
+        key = std::move(node->key);
+        value = std::move(node->value);
+        RemoveNode(node);
+        return true;
+    }
+    //*********************************************************************
+    /**
+     * removes the key lazily: the node only becomes a tombstone, in O(log n) with no rotation and no free, and its
+     * value is reset to T(). the tombstones are skipped by find, Rank, Select and the iterators, and an Emplace of
+     * the same key brings the node back. they are removed for real by CompactTombstones (a few at a time, when the
+     * caller has the time) or all at once by PurgeTombstones, which runs by itself once they are more than
+     * max_tombstone_fraction of the nodes if that is set below 1. only with the LiveSubtreeSize augmentation.
+     * @param key
+     * @return true if the key was there.
+     */
+    bool RemoveNodeLazy(KeyArg key) {
+        static_assert(Augment::kTombstones, "RemoveNodeLazy needs the LiveSubtreeSize augmentation");
+        typename Instrument::Scope scope(instrument, TreeOp::kRemoveNode);
+        Node *node = FindNode(key);
+        if (!node) return false;
+        node->value = T();
+        SetDead(node, true);
+        size--;
+        if (TombstoneCount() > max_tombstone_fraction * (size + TombstoneCount())) PurgeTombstones();
+        return true;
+    }
+    //*********************************************************************
+    /**
+     * turns a live node into a tombstone or the other way around, and moves it between the live and the dead
+     * counts of every subtree it is in. (nothing without tombstones)
+     */
+    void SetDead(Node *node, bool dead) {
+        if constexpr (Augment::kTombstones) {
+            node->dead = dead;
+            int change = dead ? -1 : 1;
+            for (Node *current = node; current; current = current->parent) {
+                current->additional_info += change;
+                current->tombstones -= change;
+            }
+        }
+    }
+
+    int TombstoneCount() const {
+        return Augment::Tombstones(root);
+    }
+    //*********************************************************************
+    /**
+     * removes up to budget tombstones with the regular RemoveNode, the first ones in key order. the tree stays
+     * usable between the calls, so the caller can spread the cleanup over its idle time.
+     * @return the number of tombstones that were removed.
+     */
+    int CompactTombstones(int budget) {
+        int removed = 0;
+        while (removed < budget && TombstoneCount()) {
+            Node *node = root; // (the first tombstone in key order: left while the left subtree has one)
+            while (Augment::Tombstones(node->left_son) || !Augment::Dead(node)) {
+                node = Augment::Tombstones(node->left_son) ? node->left_son : node->right_son;
+            }
+            RemoveNode(node);
+            removed++;
+        }
+        return removed;
+    }
+    //*********************************************************************
+    /**
+     * removes all the tombstones at once in O(n): the live nodes are relinked into a perfectly balanced tree.
+     * @return the number of tombstones that were removed.
+     */
+    int PurgeTombstones(ThreadPool &pool = DefaultThreadPool()) {
+        int dead = TombstoneCount();
+        if (!dead) return 0;
+        std::vector<Node *> nodes;
+        nodes.reserve(size + dead);
+        CollectNodes(root, nodes);
+        std::size_t live = 0;
+        for (Node *node : nodes) {
+            if (Augment::Dead(node)) {
+                DestroyNode(node);
+            } else {
+                nodes[live++] = node;
+            }
+        }
+        root = LinkBalanced(nodes.data(), static_cast<int>(live), pool);
+        ResetCachedNodes();
+        return dead;
+    }
+    //*********************************************************************
+    /**
+     * the start of the operations that don't handle tombstones: PurgeTombstones if there are any. without the
+     * LiveSubtreeSize augmentation it compiles to nothing, and the default thread pool is only used (and started)
+     * if there is something to purge and no pool was received.
+     */
+    void DropTombstones(ThreadPool *pool = nullptr) {
+        if constexpr (Augment::kTombstones) {
+            if (TombstoneCount()) PurgeTombstones(pool ? *pool : DefaultThreadPool());
+        }
+    }
+    //*********************************************************************
+    /**
+     * copies the keys of the subtree into the array in key order, at most size of them.
      * @param node - the current node.
+     * @param index - where the keys of this subtree start in the array.
+     * @return the index after the last key copied.
+     */
+    int InOrderTraversal(Node *node, Key *arr, int size, int index = 0) {
+        if (!node) return index;
+        index = InOrderTraversal(node->left_son, arr, size, index);
+        if (index >= size) return index;
+        arr[index++] = node->key;
+        return InOrderTraversal(node->right_son, arr, size, index);
+    }
+    //*********************************************************************
+    /**
+     * a batch at least 1/kBatchRebuildRatio the size of the tree is applied by rebuilding the tree in O(n + m),
+     * a smaller one is merged in O(m log(n/m + 1)).
      */
-    void PreOrderTraversal(AVLNode<T> *node) {
+    static const int kBatchRebuildRatio = 4;
+    static const int kParallelBatchCutoff = 1 << 12;
+    //*********************************************************************
+    /**
+     * appends the nodes of the subtree to the received vector in key order.
+     */
+    void CollectNodes(Node *node, std::vector<Node *> &nodes) {
         if (!node) return;
-        // do something;
-        PreOorderTraversal(node->left_son);
-        PreOorderTraversal(node->right_son);
+        CollectNodes(node->left_son, nodes);
+        nodes.push_back(node);
+        CollectNodes(node->right_son, nodes);
+    }
+    //*********************************************************************
+    /**
+     * a batch entry with the key of the kept node is dropped: in a multiset its copies go to the kept node first.
+     * (only the multiplicity, the kept node is relinked afterwards)
+     */
+    void MergeCopies(Node *kept, int copies) {
+        if constexpr (Augment::kMultiset) {
+            kept->multiplicity += copies;
+        }
+    }
+    //*********************************************************************
+    /**
+     * links count nodes (sorted by key) into a perfectly balanced subtree, without allocating anything.
+     * big halves are linked in parallel.
+     * @return the root of the subtree, with no parent.
+     */
+    Node *LinkBalanced(Node **nodes, int count, ThreadPool &pool) {
+        if (count <= 0) return nullptr;
+        int middle = count / 2;
+        Node *left = nullptr, *right = nullptr;
+        if (count >= kParallelBatchCutoff) {
+            ParallelInvoke([&] { left = LinkBalanced(nodes, middle, pool); },
+                           [&] { right = LinkBalanced(nodes + middle + 1, count - middle - 1, pool); }, pool);
+        } else {
+            left = LinkBalanced(nodes, middle, pool);
+            right = LinkBalanced(nodes + middle + 1, count - middle - 1, pool);
+        }
+        return Link(left, nodes[middle], right);
+    }
+    //*********************************************************************
+    /**
+     * the union of a detached subtree with the sorted nodes [first, last): the middle node splits the subtree, and
+     * the two sides are merged with the two halves of the array (in parallel when they are big).
+     * a batch node whose key is already in the subtree is added to garbage.
+     * @return the root of the merged subtree.
+     */
+    Node *InsertSorted(Node *node, Node **first, Node **last, std::vector<Node *> &garbage, ThreadPool &pool) {
+        if (first == last) return Detach(node);
+        Node **middle = first + (last - first) / 2;
+        bool fork = Height(node) >= kParallelSetHeight || last - first >= kParallelBatchCutoff;
+        Node *smaller = nullptr, *match = nullptr, *bigger = nullptr;
+        SplitNode(node, (*middle)->key, smaller, match, bigger);
+        Node *pivot = *middle;
+        if (match) { // keep the node that was in the tree.
+            MergeCopies(match, Augment::Copies(pivot));
+            garbage.push_back(pivot);
+            pivot = match;
+        }
+        Node *left = nullptr, *right = nullptr;
+        if (fork) {
+            std::vector<Node *> left_garbage;
+            ParallelInvoke([&] { left = InsertSorted(smaller, first, middle, left_garbage, pool); },
+                           [&] { right = InsertSorted(bigger, middle + 1, last, garbage, pool); }, pool);
+            garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+        } else {
+            left = InsertSorted(smaller, first, middle, garbage, pool);
+            right = InsertSorted(bigger, middle + 1, last, garbage, pool);
+        }
+        return JoinNodes(left, pivot, right);
+    }
+    //*********************************************************************
+    /**
+     * the difference between a detached subtree and the sorted keys [first, last), the same way as InsertSorted.
+     * the removed nodes are added to garbage.
+     * @return the root of what's left of the subtree.
+     */
+    Node *EraseSorted(Node *node, const Key *first, const Key *last, std::vector<Node *> &garbage, ThreadPool &pool) {
+        if (!node) return nullptr;
+        if (first == last) return Detach(node);
+        const Key *middle = first + (last - first) / 2;
+        bool fork = Height(node) >= kParallelSetHeight || last - first >= kParallelBatchCutoff;
+        Node *smaller = nullptr, *match = nullptr, *bigger = nullptr;
+        SplitNode(node, *middle, smaller, match, bigger);
+        if (match) garbage.push_back(match);
+        Node *left = nullptr, *right = nullptr;
+        if (fork) {
+            std::vector<Node *> left_garbage;
+            ParallelInvoke([&] { left = EraseSorted(smaller, first, middle, left_garbage, pool); },
+                           [&] { right = EraseSorted(bigger, middle + 1, last, garbage, pool); }, pool);
+            garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+        } else {
+            left = EraseSorted(smaller, first, middle, garbage, pool);
+            right = EraseSorted(bigger, middle + 1, last, garbage, pool);
+        }
+        return JoinNodes(left, right);
     }
     //*********************************************************************
     /**
-     * performs an in-order traversal and performs the necessary action along the way.
+     * adds a batch of (key, value) pairs. the batch is sorted in parallel, then either merged into the tree with
+     * the subtrees handled in parallel, or (if it's big compared to the tree) merged with the sorted nodes of the
+     * tree and the whole tree is relinked in linear time. the values are moved into the tree. like
+     * std::map::insert, a key that is already in the tree keeps its value, and of a key that is twice in the batch
+     * the first occurrence wins; the other values are dropped before any node is allocated. (in a multiset they
+     * are added as copies of the key)
+     * @param batch
+     * @param pool
+     * @return the number of keys that were added. (copies, in a multiset)
+     */
+    int InsertBatch(std::vector<std::pair<Key, T> > batch, ThreadPool &pool = DefaultThreadPool()) {
+        typedef std::pair<Key, T> Pair;
+        DropTombstones(&pool);
+        // (stable, so the first occurrence of a key stays the first one)
+        ParallelStableSort(batch.begin(), batch.end(),
+                           [](const Pair &a, const Pair &b) { return Less(a.first, b.first); }, pool);
+        std::vector<Pair *> distinct;
+        std::vector<int> copies;
+        for (Pair &pair : batch) {
+            if (distinct.empty() || !Equal(distinct.back()->first, pair.first)) {
+                distinct.push_back(&pair);
+                copies.push_back(1);
+            } else {
+                copies.back()++;
+            }
+        }
+        auto create = [this, &distinct, &copies](std::size_t j) {
+            Node *node = CreateNode(distinct[j]->first, std::move(distinct[j]->second));
+            MergeCopies(node, copies[j] - 1);
+            return node;
+        };
+        int old_size = size;
+        int added = Augment::kMultiset ? static_cast<int>(batch.size()) : 0; // (in a multiset every pair is a copy)
+        if (static_cast<long long>(distinct.size()) * kBatchRebuildRatio >= size) {
+            std::vector<Node *> tree_nodes;
+            tree_nodes.reserve(size);
+            CollectNodes(root, tree_nodes);
+            std::vector<Node *> merged;
+            merged.reserve(tree_nodes.size() + distinct.size());
+            std::size_t i = 0;
+            for (std::size_t j = 0; j < distinct.size(); j++) {
+                while (i < tree_nodes.size() && Less(tree_nodes[i]->key, distinct[j]->first)) {
+                    merged.push_back(tree_nodes[i++]);
+                }
+                if (i < tree_nodes.size() && Equal(tree_nodes[i]->key, distinct[j]->first)) {
+                    MergeCopies(tree_nodes[i], copies[j]); // the same key, keep the node that was in the tree.
+                } else {
+                    merged.push_back(create(j));
+                    if (!Augment::kMultiset) added++;
+                }
+            }
+            merged.insert(merged.end(), tree_nodes.begin() + i, tree_nodes.end());
+            root = LinkBalanced(merged.data(), static_cast<int>(merged.size()), pool);
+        } else {
+            // the keys that are already in the tree are found first, so only the new ones get a node.
+            std::vector<Key> keys;
+            keys.reserve(distinct.size());
+            for (Pair *pair : distinct) {
+                keys.push_back(pair->first);
+            }
+            std::vector<Node *> found;
+            FindBatch(keys, found);
+            std::vector<Node *> batch_nodes;
+            for (std::size_t j = 0; j < distinct.size(); j++) {
+                if (!found[j]) {
+                    batch_nodes.push_back(create(j));
+                    if (!Augment::kMultiset) added++;
+                } else if constexpr (Augment::kMultiset) {
+                    AddCopies(found[j], copies[j]);
+                }
+            }
+            std::vector<Node *> garbage; // (stays empty, none of the keys is in the tree)
+            root = InsertSorted(root, batch_nodes.data(), batch_nodes.data() + batch_nodes.size(), garbage, pool);
+        }
+        size = old_size + added;
+        ResetCachedNodes();
+        return size - old_size;
+    }
+    //*********************************************************************
+    /**
+     * removes a batch of keys, the same way as InsertBatch. keys that are not in the tree are ignored.
+     * in a multiset a key is removed with all its copies.
+     * @param keys
+     * @param pool
+     * @return the number of keys that were removed. (copies, in a multiset)
+     */
+    int EraseBatch(std::vector<Key> keys, ThreadPool &pool = DefaultThreadPool()) {
+        DropTombstones(&pool);
+        ParallelSort(keys.begin(), keys.end(), [](const Key &a, const Key &b) { return Less(a, b); }, pool);
+        keys.erase(std::unique(keys.begin(), keys.end(), [](const Key &a, const Key &b) { return Equal(a, b); }),
+                   keys.end());
+        int old_size = size;
+        std::vector<Node *> garbage;
+        if (static_cast<long long>(keys.size()) * kBatchRebuildRatio >= size) {
+            std::vector<Node *> tree_nodes;
+            tree_nodes.reserve(size);
+            CollectNodes(root, tree_nodes);
+            std::vector<Node *> kept;
+            kept.reserve(tree_nodes.size());
+            std::size_t j = 0;
+            for (Node *node : tree_nodes) {
+                while (j < keys.size() && Less(keys[j], node->key)) j++;
+                if (j < keys.size() && Equal(keys[j], node->key)) {
+                    garbage.push_back(node);
+                } else {
+                    kept.push_back(node);
+                }
+            }
+            root = LinkBalanced(kept.data(), static_cast<int>(kept.size()), pool);
+        } else {
+            root = EraseSorted(root, keys.data(), keys.data() + keys.size(), garbage, pool);
+        }
+        int removed = 0;
+        for (Node *node : garbage) {
+            removed += Augment::Copies(node);
+            DestroyNode(node);
+        }
+        size = old_size - removed;
+        ResetCachedNodes();
+        return old_size - size;
+    }
+    //*********************************************************************
+    /**
+     * performs a pre-order traversal and calls function(node) on every node along the way.
+     * @param node - the current node.
+     */
+    template<class Function>
+    void PreOrderTraversal(Node *node, Function &&function) {
+        if (!node) return;
+        function(*node);
+        PreOrderTraversal(node->left_son, function);
+        PreOrderTraversal(node->right_son, function);
+    }
+    //*********************************************************************
+    /**
+     * performs a post-order traversal and calls function(node) on every node along the way.
      * @param node - the current node.
      */
-    void PostOrderTraversal(AVLNode<T> *node) {
+    template<class Function>
+    void PostOrderTraversal(Node *node, Function &&function) {
         if (!node) return;
-        PostOrderTraversal(node->left_son);
-        PostOrderTraversal(node->right_son);
-        // do something;
+        PostOrderTraversal(node->left_son, function);
+        PostOrderTraversal(node->right_son, function);
+        function(*node);
+    }
+    //*********************************************************************
+    /**
+     * calls function(node) on every live node of the subtree, in key order.
+     */
+    template<class Function>
+    void InOrderNodes(Node *node, Function &&function) {
+        while (node) {
+            InOrderNodes(node->left_son, function);
+            if (!Augment::Dead(node)) function(*node);
+            node = node->right_son;
+        }
+    }
+    //*********************************************************************
+    /**
+     * the parallel traversals cut the tree into about kParallelChunksPerThread pieces per thread of the pool, so a
+     * thread that finishes early takes another piece, and never into pieces smaller than kParallelTraversalCutoff
+     * nodes, which are not worth a task.
+     */
+    static const int kParallelChunksPerThread = 8;
+    static const int kParallelTraversalCutoff = 1 << 12;
+
+    // the number of nodes in a piece of a parallel traversal.
+    long long ParallelGrain(ThreadPool &pool) {
+        long long pieces = static_cast<long long>(pool.Size()) * kParallelChunksPerThread;
+        long long grain = static_cast<long long>(size) / pieces;
+        return grain > kParallelTraversalCutoff ? grain : kParallelTraversalCutoff;
+    }
+
+    // the number of nodes in the subtree, estimated from its height without the subtree sizes.
+    long long SubtreeCount(const Node *node) {
+        if (Augment::kHasSize) return Augment::Count(node) + Augment::Tombstones(node);
+        return node ? (1LL << Height(node)) : 0; // (between the smallest and the biggest count of that height)
+    }
+    //*********************************************************************
+    /**
+     * calls function(node) on every node of the tree, on the threads of the pool: the subtrees are cut by their
+     * sizes into pieces of about the same number of nodes, and each piece is walked on one thread, in key order.
+     * the pieces run at the same time, so the function must be safe to call concurrently (on different nodes),
+     * and must not change the shape of the tree. the values may be changed: with an augmentation that reads them
+     * (Augment::kUsesValues) every piece recomputes the fields of its nodes bottom-up once it is done.
+     * @param function - called as function(Node &).
+     * @param pool
+     */
+    template<class Function>
+    void ParallelForEach(Function function, ThreadPool &pool = DefaultThreadPool()) {
+        if (pool.Size() < 2) {
+            InOrderNodes(root, function);
+            RefreshValueInfo(root);
+            return;
+        }
+        ParallelForEachNode(root, function, ParallelGrain(pool), pool);
+    }
+
+    template<class Function>
+    void ParallelForEachNode(Node *node, Function &function, long long grain, ThreadPool &pool) {
+        if (SubtreeCount(node) <= grain) {
+            InOrderNodes(node, function);
+            RefreshValueInfo(node);
+            return;
+        }
+        ParallelInvoke([&] { ParallelForEachNode(node->left_son, function, grain, pool); },
+                       [&] { ParallelForEachNode(node->right_son, function, grain, pool); }, pool);
+        if (!Augment::Dead(node)) function(*node);
+        if constexpr (Augment::kUsesValues) Augment::Update(node);
+    }
+
+    // recomputes the augmentation fields of a subtree bottom-up after its values changed. (nothing if the
+    // augmentation does not read the values)
+    void RefreshValueInfo(Node *node) {
+        if constexpr (Augment::kUsesValues) {
+            if (!node) return;
+            RefreshValueInfo(node->left_son);
+            RefreshValueInfo(node->right_son);
+            Augment::Update(node);
+        }
+    }
+    //*********************************************************************
+    /**
+     * combines transform(node) of all the nodes in key order, in parallel: the pieces of the tree (see
+     * ParallelForEach) are reduced on their own and their results are combined in key order, so the result is
+     * the same as combine(...combine(combine(identity, t(1)), t(2))..., t(n)) for a combine that is only
+     * associative, not commutative. (appending strings, composing functions...)
+     * @param identity - the identity of combine, every piece starts from a copy of it.
+     * @param transform - called as transform(const Node &), concurrently.
+     * @param combine - called as combine(R, R), associative.
+     * @param pool
+     * @return the combined result, identity for an empty tree.
+     */
+    template<class R, class Transform, class Combine>
+    R TransformReduce(R identity, Transform transform, Combine combine, ThreadPool &pool = DefaultThreadPool()) {
+        long long grain = pool.Size() < 2 ? static_cast<long long>(size) : ParallelGrain(pool);
+        return TransformReduceNode(root, identity, transform, combine, grain, pool);
+    }
+
+    template<class R, class Transform, class Combine>
+    R TransformReduceNode(Node *node, const R &identity, Transform &transform, Combine &combine, long long grain,
+                          ThreadPool &pool) {
+        if (SubtreeCount(node) <= grain) {
+            R result = identity;
+            InOrderNodes(node, [&](const Node &current) { result = combine(std::move(result), transform(current)); });
+            return result;
+        }
+        R left = identity, right = identity;
+        ParallelInvoke([&] { left = TransformReduceNode(node->left_son, identity, transform, combine, grain, pool); },
+                       [&] { right = TransformReduceNode(node->right_son, identity, transform, combine, grain, pool); },
+                       pool);
+        if (Augment::Dead(node)) return combine(std::move(left), std::move(right));
+        return combine(combine(std::move(left), transform(static_cast<const Node &>(*node))), std::move(right));
+    }
+    //*********************************************************************
+    /**
+     * TransformReduce of the values: combine(...combine(identity, value 1)..., value n) in key order, in parallel.
+     * @param combine - called as combine(R, R), associative. the values are converted to R.
+     */
+    template<class R, class Combine>
+    R Reduce(R identity, Combine combine, ThreadPool &pool = DefaultThreadPool()) {
+        return TransformReduce(identity, [](const Node &node) -> R { return node.value; }, combine, pool);
     }
     //*********************************************************************
 };
 
+//*********************************************************************
+// an AVLTree with the key type (and its comparator) first, for keys that are not ints.
+template<class Key, class T, class Compare = std::less<Key>, class Augment = SubtreeSize,
+        template<class> class Allocator = AVLNodePool>
+using AVLMap = AVLTree<T, Allocator, Augment, NoInstrumentation, Key, Compare>;
+
 #endif //MYAVLTREE_AVLTREE_H
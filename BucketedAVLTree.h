@@ -0,0 +1,339 @@
+//
+// An AVL tree whose leaves are small sorted arrays: the AVL tree only routes, the keys live in buckets.
+//
+/**
+ * Bucketed AVL Tree
+ * the keys and values are kept in buckets of up to kBucketCapacity entries, each a sorted array of keys next to
+ * an array of values. the buckets are the nodes of an AVLTree keyed by the lowest key the bucket may hold (its
+ * low), so the AVL balancing only runs on the routing levels, one node per bucket instead of one per key:
+ *  - a lookup chases pointers down the routing tree, which is kBucketCapacity times smaller than an AVLTree of the
+ *    same keys, and then searches one array in one or two cache lines of keys.
+ *  - the node overhead (the three pointers, the height, the balance factor) is paid once per bucket. with an int
+ *    value a full bucket of 64 entries is ~8.5 bytes per entry, against 48 for an AVLNode.
+ * a full bucket is split in two halves, the second half becomes a new bucket. a bucket that drops to a quarter
+ * full is merged with a neighbour if the two fit in half a bucket together, and an empty bucket is removed.
+ * the routing nodes count the entries of their subtree (the BucketEntries augmentation), so Rank and Select
+ * still take O(log n).
+ * the value must be default constructible and move assignable: a bucket holds kBucketCapacity values whether
+ * they are used or not, and the entries are moved around inside and between the buckets.
+ * the pointers returned by find and Select are valid until the next change of the tree.
+ * the following functions are available:
+ * Emplace           - adds a key with a value constructed from the received arguments.
+ *
+ * AddNode           - adds a key and a value. both return false if the key is already there.
+ *
+ * RemoveNode        - removes a key, returns false if it was not there.
+ *
+ * find              - returns a pointer to the value of the received key, or nullptr.
+ *
+ * Rank / Select     - the same as in AVLTree: the index(+1) of a key in sorted order, the value (and key) at an
+ *                     index(+1).
+ *
+ * ForEach           - calls a function on every (key, value) in key order.
+ *
+ * Size / BucketCount / MemoryBytes
+ */
+
+#ifndef MYAVLTREE_BUCKETEDAVLTREE_H
+#define MYAVLTREE_BUCKETEDAVLTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include "AVLTree.h"
+
+template<class T, int kCapacity>
+struct AVLBucket {
+    int count;
+    int keys[kCapacity];  // sorted, the first count are used.
+    T values[kCapacity];
+
+    AVLBucket() : count(0) {}
+
+    // the position of the first key that is not smaller than the received key.
+    int LowerBound(int key) const {
+        return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+    }
+};
+
+//*********************************************************************
+/**
+ * the augmentation of the routing tree: additional_info is the number of entries in the buckets of the subtree.
+ * (not the number of nodes, so the tree's own Rank and Select are not available, kHasSize is false)
+ */
+struct BucketEntries {
+    static const bool kHasSize = false;
+    static const bool kTombstones = false;
+    static const bool kMultiset = false;
+    static const bool kUsesValues = true; // (the count of the bucket)
+
+    struct Data {
+        int additional_info = 0;
+    };
+
+    template<class Node>
+    static int Entries(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+
+    template<class Node>
+    static int Count(const Node *node) {
+        if (!node) return 0;
+        return Count(node->left_son) + Count(node->right_son) + 1;
+    }
+
+    template<class Node>
+    static void Update(Node *node) {
+        node->additional_info = Entries(node->left_son) + Entries(node->right_son) + node->value.count;
+    }
+
+    template<class Node>
+    static bool Dead(const Node *) {
+        return false;
+    }
+
+    template<class Node>
+    static int Tombstones(const Node *) {
+        return 0;
+    }
+
+    template<class Node>
+    static int Copies(const Node *) {
+        return 1;
+    }
+};
+
+//*********************************************************************
+template<class T, int kBucketCapacity = 64>
+class BucketedAVLTree {
+public:
+    static_assert(kBucketCapacity >= 4, "a bucket must hold at least 4 entries");
+    typedef AVLBucket<T, kBucketCapacity> Bucket;
+    typedef AVLTree<Bucket, AVLNodePool, BucketEntries> Tree;
+    typedef typename Tree::Node Node;
+
+    BucketedAVLTree() : count(0) {}
+
+    BucketedAVLTree(const BucketedAVLTree &) = delete;
+    BucketedAVLTree &operator=(const BucketedAVLTree &) = delete;
+    //*********************************************************************
+    int Size() const {
+        return count;
+    }
+
+    int BucketCount() const {
+        return tree.size;
+    }
+
+    // the memory of the buckets, used or not. (the pool may hold a few more slots)
+    std::size_t MemoryBytes() const {
+        return static_cast<std::size_t>(tree.size) * sizeof(Node);
+    }
+    //*********************************************************************
+    /**
+     * returns a pointer to the value of the received key, or nullptr.
+     * @param key
+     */
+    T *find(int key) {
+        Node *node = Route(key);
+        if (!node) return nullptr;
+        Bucket &bucket = node->value;
+        int position = bucket.LowerBound(key);
+        if (position == bucket.count || bucket.keys[position] != key) return nullptr;
+        return &bucket.values[position];
+    }
+    //*********************************************************************
+    /**
+     * returns the index(+1) of the key if the keys were in a sorted array, or -1.
+     * @param key
+     */
+    int Rank(int key) const {
+        const Node *current = tree.root;
+        const Node *bucket_node = nullptr;
+        int before = 0, bucket_before = 0; // the entries before the current subtree, before the bucket.
+        while (current) {
+            if (current->key <= key) {
+                bucket_node = current;
+                bucket_before = before + BucketEntries::Entries(current->left_son);
+                before = bucket_before + current->value.count;
+                current = current->right_son;
+            } else {
+                current = current->left_son;
+            }
+        }
+        if (!bucket_node) return -1;
+        const Bucket &bucket = bucket_node->value;
+        int position = bucket.LowerBound(key);
+        if (position == bucket.count || bucket.keys[position] != key) return -1;
+        return bucket_before + position + 1;
+    }
+    //*********************************************************************
+    /**
+     * returns a pointer to the value at the received index(+1) in sorted order, or nullptr.
+     * @param index
+     * @param key - if not nullptr, receives the key at the index.
+     */
+    T *Select(int index, int *key = nullptr) {
+        Node *current = tree.root;
+        while (current) {
+            int left_entries = BucketEntries::Entries(current->left_son);
+            if (index <= left_entries) {
+                current = current->left_son;
+            } else if (index <= left_entries + current->value.count) {
+                int position = index - left_entries - 1;
+                if (key) *key = current->value.keys[position];
+                return &current->value.values[position];
+            } else {
+                index = index - left_entries - current->value.count;
+                current = current->right_son;
+            }
+        }
+        return nullptr;
+    }
+    //*********************************************************************
+    /**
+     * adds a key with a value constructed from the received arguments, nothing is constructed if the key is
+     * already there. a full bucket is split first.
+     * @return true if added, false if the key was already there.
+     */
+    template<class... Args>
+    bool Emplace(int key, Args &&... args) {
+        Node *node = Route(key);
+        if (!node) {
+            node = tree.root ? tree.PeekMin() : tree.Emplace(key).first;
+            node->key = key; // the new smallest key, the routing order stays the same.
+        }
+        int position = node->value.LowerBound(key);
+        if (position < node->value.count && node->value.keys[position] == key) return false;
+        if (node->value.count == kBucketCapacity) {
+            Node *right = SplitBucket(node);
+            if (key >= right->key) {
+                node = right;
+                position -= kBucketCapacity / 2;
+            }
+        }
+        Bucket &bucket = node->value;
+        std::move_backward(bucket.keys + position, bucket.keys + bucket.count, bucket.keys + bucket.count + 1);
+        std::move_backward(bucket.values + position, bucket.values + bucket.count, bucket.values + bucket.count + 1);
+        bucket.keys[position] = key;
+        bucket.values[position] = T(std::forward<Args>(args)...);
+        bucket.count++;
+        AddToPath(node, 1);
+        count++;
+        return true;
+    }
+
+    bool AddNode(int key, T value) {
+        return Emplace(key, std::move(value));
+    }
+    //*********************************************************************
+    /**
+     * removes the received key. a bucket left a quarter full is merged with a neighbour if they fit in half a
+     * bucket together, an empty one is removed.
+     * @return true if the key was there.
+     */
+    bool RemoveNode(int key) {
+        Node *node = Route(key);
+        if (!node) return false;
+        Bucket &bucket = node->value;
+        int position = bucket.LowerBound(key);
+        if (position == bucket.count || bucket.keys[position] != key) return false;
+        std::move(bucket.keys + position + 1, bucket.keys + bucket.count, bucket.keys + position);
+        std::move(bucket.values + position + 1, bucket.values + bucket.count, bucket.values + position);
+        bucket.count--;
+        bucket.values[bucket.count] = T(); // whatever the removed value held is released here.
+        AddToPath(node, -1);
+        count--;
+        if (bucket.count <= kBucketCapacity / 4) MergeBucket(node);
+        return true;
+    }
+    //*********************************************************************
+    /**
+     * calls function(key, value) on every entry, in key order.
+     */
+    template<class Function>
+    void ForEach(Function function) {
+        for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            Bucket &bucket = it->value;
+            for (int i = 0; i < bucket.count; i++) {
+                function(bucket.keys[i], bucket.values[i]);
+            }
+        }
+    }
+
+private:
+    Tree tree;
+    int count;
+
+    /**
+     * the bucket whose range has the key: the one with the biggest low that is not bigger than the key, or nullptr
+     * if the key is smaller than all of them.
+     */
+    Node *Route(int key) const {
+        Node *current = tree.root;
+        Node *candidate = nullptr;
+        while (current) {
+            if (current->key <= key) {
+                candidate = current;
+                current = current->right_son;
+            } else {
+                current = current->left_son;
+            }
+        }
+        return candidate;
+    }
+
+    // the number of entries of a bucket changed by delta, the counts up to the root follow.
+    void AddToPath(Node *node, int delta) {
+        for (; node; node = node->parent) {
+            node->additional_info += delta;
+        }
+    }
+    //*********************************************************************
+    /**
+     * moves the second half of a full bucket into a new bucket after it.
+     * @return the new bucket.
+     */
+    Node *SplitBucket(Node *node) {
+        const int half = kBucketCapacity / 2;
+        Node *right = tree.Emplace(node->value.keys[half]).first;
+        Bucket &from = node->value;
+        Bucket &to = right->value;
+        std::move(from.keys + half, from.keys + from.count, to.keys);
+        std::move(from.values + half, from.values + from.count, to.values);
+        to.count = from.count - half;
+        from.count = half;
+        for (int i = half; i < kBucketCapacity; i++) {
+            from.values[i] = T();
+        }
+        tree.UpdatePathInfo(right);
+        tree.UpdatePathInfo(node);
+        return right;
+    }
+    //*********************************************************************
+    /**
+     * merges a bucket that got small with the smaller of its neighbours, if the two fit in half a bucket. an empty
+     * bucket is removed even if it can't be merged, its range goes to the bucket before it.
+     */
+    void MergeBucket(Node *node) {
+        Node *before = Tree::Predecessor(node);
+        Node *after = Tree::Successor(node);
+        Node *left = node;
+        if (before && (!after || before->value.count < after->value.count)) left = before;
+        Node *right = left == node ? after : node;
+        if (!right || left->value.count + right->value.count > kBucketCapacity / 2) {
+            if (!node->value.count) tree.RemoveNode(node);
+            return;
+        }
+        Bucket &to = left->value;
+        Bucket &from = right->value;
+        std::move(from.keys, from.keys + from.count, to.keys + to.count);
+        std::move(from.values, from.values + from.count, to.values + to.count);
+        to.count += from.count;
+        from.count = 0;
+        tree.RemoveNode(right); // (moves nodes, not buckets, so left stays where it is)
+        tree.UpdatePathInfo(left);
+    }
+};
+
+#endif //MYAVLTREE_BUCKETEDAVLTREE_H
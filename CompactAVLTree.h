@@ -0,0 +1,371 @@
+//
+// An AVL tree with its nodes in one vector, linked by 32 bit indices, for a small memory footprint.
+//
+/**
+ * Compact AVL Tree
+ * the same ranked AVL tree as AVLTree, stored compactly:
+ *  - the nodes live in one std::vector and point at each other with 32 bit indices instead of 64 bit pointers.
+ *  - there are no parent links, the operations that change the tree remember the path they came down on instead.
+ *  - the height (6 bits, an AVL tree of 2^32 nodes is less than 48 high) and the balance factor (2 bits) are
+ *    packed in one byte.
+ * with an int value a node takes 24 bytes, half of an AVLNode, and the nodes are next to each other in memory.
+ * removed nodes are recycled through a free list, the vector never shrinks (Clear empties it).
+ * the value must be default constructible and move assignable: a recycled node gets its new value by assignment,
+ * and a removed node holds a default constructed value until it is recycled.
+ * the pointers returned by find and Select are valid until the next AddNode / Emplace (the vector may grow) or
+ * RemoveNode (removing a node with two sons moves the key and value of its successor into its slot).
+ * the following functions are available:
+ * Emplace           - adds a key with a value constructed from the received arguments.
+ *
+ * AddNode           - adds a key and a value. both return false if the key is already there.
+ *
+ * RemoveNode        - removes a key, returns false if it was not there.
+ *
+ * find              - returns the node with the received key, or nullptr.
+ *
+ * Rank / Select     - the same as in AVLTree: the index(+1) of a key in sorted order, the node at an index(+1).
+ *
+ * ForEach           - calls a function on every node in key order.
+ *
+ * Size / Height / Reserve / Clear / MemoryBytes
+ */
+
+#ifndef MYAVLTREE_COMPACTAVLTREE_H
+#define MYAVLTREE_COMPACTAVLTREE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template<class T>
+struct CompactAVLNode {
+    static const std::uint32_t kNil = 0xFFFFFFFF; // the index of no node.
+
+    int key;
+    std::uint32_t left_son;
+    std::uint32_t right_son;
+    std::uint32_t additional_info; // the size of the subtree.
+    std::uint8_t meta;             // height << 2 | (balance_factor + 1)
+    T value;
+
+    template<class... Args>
+    explicit CompactAVLNode(int key, Args &&... args) : key(key), left_son(kNil), right_son(kNil), additional_info(1),
+                                                        meta(1), value(std::forward<Args>(args)...) {}
+
+    int Height() const {
+        return meta >> 2;
+    }
+
+    int BalanceFactor() const {
+        return (meta & 3) - 1;
+    }
+};
+
+template<class T>
+class CompactAVLTree {
+public:
+    typedef CompactAVLNode<T> Node;
+    static const std::uint32_t kNil = Node::kNil;
+    static const int kMaxHeight = 63; // what fits in the 6 bits of the height.
+
+    CompactAVLTree() : root(kNil), free_list(kNil), count(0) {}
+    //*********************************************************************
+    int Size() const {
+        return static_cast<int>(count);
+    }
+
+    int Height() const {
+        return Height(root);
+    }
+    //*********************************************************************
+    /**
+     * makes room for the received number of nodes, so the vector does not grow (and keeps its pointers) until then.
+     */
+    void Reserve(int nodes_count) {
+        nodes.reserve(nodes_count);
+    }
+
+    void Clear() {
+        nodes.clear();
+        root = kNil;
+        free_list = kNil;
+        count = 0;
+    }
+
+    // the memory the nodes take, including the free and the reserved slots.
+    std::size_t MemoryBytes() const {
+        return nodes.capacity() * sizeof(Node);
+    }
+    //*********************************************************************
+    /**
+     * returns the node with the received key, or nullptr.
+     * @param key
+     */
+    Node *find(int key) {
+        std::uint32_t current = root;
+        while (current != kNil) {
+            Node &node = nodes[current];
+            if (key == node.key) return &node;
+            current = key < node.key ? node.left_son : node.right_son;
+        }
+        return nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the index(+1) of the node with the matching key if it was in a sorted array, or -1.
+     * @param key
+     */
+    int Rank(int key) const {
+        int r = 0;
+        std::uint32_t current = root;
+        while (current != kNil) {
+            const Node &node = nodes[current];
+            if (key < node.key) {
+                current = node.left_son;
+                continue;
+            }
+            r = r + static_cast<int>(Size(node.left_son)) + 1;
+            if (key == node.key) return r;
+            current = node.right_son;
+        }
+        return -1;
+    }
+    //*********************************************************************
+    /**
+     * returns the node at the received index(+1) in sorted order, or nullptr.
+     * @param index
+     */
+    Node *Select(int index) {
+        std::uint32_t current = root;
+        while (current != kNil) {
+            Node &node = nodes[current];
+            int left_size = static_cast<int>(Size(node.left_son));
+            if (index <= left_size) {
+                current = node.left_son;
+            } else if (index == left_size + 1) {
+                return &node;
+            } else {
+                index = index - left_size - 1;
+                current = node.right_son;
+            }
+        }
+        return nullptr;
+    }
+    //*********************************************************************
+    /**
+     * adds a key with a value constructed from the received arguments, nothing is constructed if the key is
+     * already there.
+     * @return the node with the key, and true if it was added.
+     */
+    template<class... Args>
+    std::pair<Node *, bool> Emplace(int key, Args &&... args) {
+        std::uint32_t path[kMaxHeight + 1];
+        int depth = 0;
+        std::uint32_t current = root;
+        while (current != kNil) {
+            Node &node = nodes[current];
+            if (key == node.key) return std::make_pair(&node, false);
+            path[depth++] = current;
+            current = key < node.key ? node.left_son : node.right_son;
+        }
+        std::uint32_t index = NewNode(key, std::forward<Args>(args)...);
+        if (!depth) {
+            root = index;
+        } else if (key < nodes[path[depth - 1]].key) {
+            nodes[path[depth - 1]].left_son = index;
+        } else {
+            nodes[path[depth - 1]].right_son = index;
+        }
+        count++;
+        Retrace(path, depth, 1);
+        return std::make_pair(&nodes[index], true);
+    }
+    //*********************************************************************
+    /**
+     * @param key
+     * @param value - moved into the node.
+     * @return true if added, false if the key was already there.
+     */
+    bool AddNode(int key, T value) {
+        return Emplace(key, std::move(value)).second;
+    }
+    //*********************************************************************
+    /**
+     * removes the node with the received key. a node with two sons takes the key and the value of its in-order
+     * successor, and the successor's node is the one that is unlinked.
+     * @param key
+     * @return true if the key was found.
+     */
+    bool RemoveNode(int key) {
+        std::uint32_t path[kMaxHeight + 1];
+        int depth = 0;
+        std::uint32_t current = root;
+        while (current != kNil && nodes[current].key != key) {
+            path[depth++] = current;
+            current = key < nodes[current].key ? nodes[current].left_son : nodes[current].right_son;
+        }
+        if (current == kNil) return false;
+        std::uint32_t removed = current;
+        if (nodes[current].left_son != kNil && nodes[current].right_son != kNil) {
+            path[depth++] = current;
+            std::uint32_t successor = nodes[current].right_son;
+            while (nodes[successor].left_son != kNil) {
+                path[depth++] = successor;
+                successor = nodes[successor].left_son;
+            }
+            nodes[current].key = nodes[successor].key;
+            nodes[current].value = std::move(nodes[successor].value);
+            removed = successor;
+        }
+        const Node &dead = nodes[removed];
+        std::uint32_t son = dead.left_son != kNil ? dead.left_son : dead.right_son;
+        ReplaceSon(depth ? path[depth - 1] : kNil, removed, son);
+        FreeNode(removed);
+        count--;
+        Retrace(path, depth, -1);
+        return true;
+    }
+    //*********************************************************************
+    /**
+     * calls function(node) on every node, in key order.
+     */
+    template<class Function>
+    void ForEach(Function function) {
+        std::uint32_t stack[kMaxHeight + 1];
+        int depth = 0;
+        std::uint32_t current = root;
+        while (current != kNil || depth) {
+            while (current != kNil) {
+                stack[depth++] = current;
+                current = nodes[current].left_son;
+            }
+            current = stack[--depth];
+            function(nodes[current]);
+            current = nodes[current].right_son;
+        }
+    }
+
+private:
+    std::vector<Node> nodes;
+    std::uint32_t root;
+    std::uint32_t free_list; // the removed nodes, linked through left_son.
+    std::uint32_t count;
+
+    int Height(std::uint32_t index) const {
+        return index == kNil ? -1 : nodes[index].Height();
+    }
+
+    std::uint32_t Size(std::uint32_t index) const {
+        return index == kNil ? 0 : nodes[index].additional_info;
+    }
+    //*********************************************************************
+    template<class... Args>
+    std::uint32_t NewNode(int key, Args &&... args) {
+        if (free_list == kNil) {
+            nodes.emplace_back(key, std::forward<Args>(args)...);
+            return static_cast<std::uint32_t>(nodes.size() - 1);
+        }
+        std::uint32_t index = free_list;
+        Node &node = nodes[index];
+        free_list = node.left_son;
+        node.key = key;
+        node.left_son = kNil;
+        node.right_son = kNil;
+        node.additional_info = 1;
+        node.meta = 1;
+        node.value = T(std::forward<Args>(args)...);
+        return index;
+    }
+
+    void FreeNode(std::uint32_t index) {
+        nodes[index].value = T(); // whatever the value holds is released here.
+        nodes[index].left_son = free_list;
+        nodes[index].right_son = kNil;
+        free_list = index;
+    }
+    //*********************************************************************
+    void ReplaceSon(std::uint32_t parent, std::uint32_t old_son, std::uint32_t new_son) {
+        if (parent == kNil) {
+            root = new_son;
+        } else if (nodes[parent].left_son == old_son) {
+            nodes[parent].left_son = new_son;
+        } else {
+            nodes[parent].right_son = new_son;
+        }
+    }
+    //*********************************************************************
+    /**
+     * recomputes the height, balance factor and size of a node from its sons.
+     * @return the balance factor, which is only stored if it is in [-1, 1]. (a node at +-2 is rotated right away)
+     */
+    int Update(std::uint32_t index) {
+        Node &node = nodes[index];
+        int left_height = Height(node.left_son);
+        int right_height = Height(node.right_son);
+        int height = (left_height > right_height ? left_height : right_height) + 1;
+        int balance_factor = left_height - right_height;
+        node.meta = static_cast<std::uint8_t>(height << 2 | ((balance_factor + 1) & 3));
+        node.additional_info = Size(node.left_son) + Size(node.right_son) + 1;
+        return balance_factor;
+    }
+
+    std::uint32_t RotateRight(std::uint32_t index) { // LL
+        std::uint32_t left = nodes[index].left_son;
+        nodes[index].left_son = nodes[left].right_son;
+        nodes[left].right_son = index;
+        Update(index);
+        Update(left);
+        return left;
+    }
+
+    std::uint32_t RotateLeft(std::uint32_t index) { // RR
+        std::uint32_t right = nodes[index].right_son;
+        nodes[index].right_son = nodes[right].left_son;
+        nodes[right].left_son = index;
+        Update(index);
+        Update(right);
+        return right;
+    }
+    //*********************************************************************
+    /**
+     * updates a node and rotates it if it is out of balance.
+     * @return the root of the subtree after the rotations.
+     */
+    std::uint32_t Rebalance(std::uint32_t index) {
+        int balance_factor = Update(index);
+        if (balance_factor == 2) {
+            if (nodes[nodes[index].left_son].BalanceFactor() < 0) {
+                nodes[index].left_son = RotateLeft(nodes[index].left_son);
+            }
+            return RotateRight(index);
+        }
+        if (balance_factor == -2) {
+            if (nodes[nodes[index].right_son].BalanceFactor() > 0) {
+                nodes[index].right_son = RotateRight(nodes[index].right_son);
+            }
+            return RotateLeft(index);
+        }
+        return index;
+    }
+    //*********************************************************************
+    /**
+     * walks up the received path (from the root down to the parent of the changed spot) and rebalances. once the
+     * height of a subtree did not change, the nodes above it only have their size moved by size_change.
+     */
+    void Retrace(const std::uint32_t *path, int depth, int size_change) {
+        bool settled = false;
+        for (int d = depth - 1; d >= 0; d--) {
+            std::uint32_t index = path[d];
+            if (settled) {
+                nodes[index].additional_info += size_change;
+                continue;
+            }
+            int old_height = nodes[index].Height();
+            std::uint32_t top = Rebalance(index);
+            if (top != index) ReplaceSon(d ? path[d - 1] : kNil, index, top);
+            if (nodes[top].Height() == old_height) settled = true;
+        }
+    }
+};
+
+#endif //MYAVLTREE_COMPACTAVLTREE_H
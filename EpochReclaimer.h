@@ -0,0 +1,168 @@
+//
+// Epoch based memory reclamation, for structures that are read without locks.
+//
+/**
+ * readers Pin() the reclaimer before they load any shared pointer and keep the returned Guard for as long as they
+ * use what they read. the (single) writer unlinks objects, Retire()s them and then calls Advance(), which frees
+ * every retired object that no pinned reader can still reach. the objects retired while a reader was pinned are
+ * only freed by a later Advance, so the owner calls it again after the last Retire, once the readers are gone.
+ *
+ * how it works: there is a global epoch counter. a reader announces the epoch it saw in a slot of its own while it
+ * is pinned. an object retired at epoch E was unlinked before the epoch moved past E, so a reader that pinned at a
+ * later epoch can't reach it, and it is freed as soon as every pinned reader announced an epoch bigger than E.
+ *
+ * Pin               - pins the calling thread, at most kMaxReaders threads can be pinned at the same time.
+ *
+ * Retire            - hands an unlinked object to the reclaimer with the function that frees it. (writer only)
+ *
+ * Advance           - moves to the next epoch and frees what is safe to free. (writer only, or anyone who is
+ *                     serialized with the writer. nothing happens if nothing is retired)
+ *
+ * PendingCount      - the number of retired objects that are not freed yet.
+ *
+ * PinnedCount       - the number of readers pinned right now.
+ */
+
+#ifndef MYAVLTREE_EPOCHRECLAIMER_H
+#define MYAVLTREE_EPOCHRECLAIMER_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <thread>
+
+class EpochReclaimer {
+public:
+    static const int kMaxReaders = 64;
+
+    class Guard {
+    public:
+        Guard() : owner(nullptr), slot(-1) {}
+
+        Guard(EpochReclaimer *owner, int slot) : owner(owner), slot(slot) {}
+
+        Guard(Guard &&other) noexcept : owner(other.owner), slot(other.slot) {
+            other.owner = nullptr;
+        }
+
+        Guard &operator=(Guard &&other) noexcept {
+            if (this != &other) {
+                Release();
+                owner = other.owner;
+                slot = other.slot;
+                other.owner = nullptr;
+            }
+            return *this;
+        }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        ~Guard() {
+            Release();
+        }
+
+        void Release() {
+            if (owner) {
+                owner->readers[slot].epoch.store(0, std::memory_order_release);
+                owner = nullptr;
+            }
+        }
+
+    private:
+        EpochReclaimer *owner;
+        int slot;
+    };
+
+    EpochReclaimer() : global_epoch(1) {}
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    // no reader may be pinned anymore at this point. (checked in debug builds)
+    ~EpochReclaimer() {
+        assert(PinnedCount() == 0 && "an EpochReclaimer is destroyed while a reader is pinned");
+        for (Retired &object : retired) {
+            object.deleter(object.object);
+        }
+    }
+    //*********************************************************************
+    /**
+     * pins the calling thread at the current epoch. the first free slot is taken, starting from a slot chosen by
+     * the thread id so threads don't all fight over the same ones.
+     * @return the guard that keeps the thread pinned.
+     */
+    Guard Pin() {
+        int start = static_cast<int>(std::hash<std::thread::id>()(std::this_thread::get_id()) % kMaxReaders);
+        while (true) {
+            for (int i = 0; i < kMaxReaders; i++) {
+                int slot = (start + i) % kMaxReaders;
+                std::uint64_t free_slot = 0;
+                std::uint64_t epoch = global_epoch.load(std::memory_order_seq_cst);
+                if (readers[slot].epoch.load(std::memory_order_relaxed) == 0 &&
+                    readers[slot].epoch.compare_exchange_strong(free_slot, epoch, std::memory_order_seq_cst)) {
+                    return Guard(this, slot);
+                }
+            }
+            std::this_thread::yield(); // all the slots are taken, wait for a reader to leave.
+        }
+    }
+    //*********************************************************************
+    /**
+     * @param object - already unreachable for readers that pin from now on.
+     * @param deleter - frees the object.
+     */
+    void Retire(void *object, void (*deleter)(void *)) {
+        retired.push_back(Retired{global_epoch.load(std::memory_order_relaxed), object, deleter});
+    }
+    //*********************************************************************
+    /**
+     * moves to the next epoch and frees every retired object that is older than the oldest pinned reader.
+     * the objects are retired in epoch order, so only the front of the queue has to be checked.
+     */
+    void Advance() {
+        if (retired.empty()) return; // (so frequent calls between the writes don't move the epoch for nothing)
+        global_epoch.fetch_add(1, std::memory_order_seq_cst);
+        std::uint64_t oldest = UINT64_MAX;
+        for (int i = 0; i < kMaxReaders; i++) {
+            std::uint64_t epoch = readers[i].epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0 && epoch < oldest) oldest = epoch;
+        }
+        while (!retired.empty() && retired.front().epoch < oldest) {
+            retired.front().deleter(retired.front().object);
+            retired.pop_front();
+        }
+    }
+    //*********************************************************************
+    int PendingCount() const {
+        return static_cast<int>(retired.size());
+    }
+
+    // (only a hint while readers come and go)
+    int PinnedCount() const {
+        int pinned = 0;
+        for (const ReaderSlot &reader : readers) {
+            pinned += reader.epoch.load(std::memory_order_relaxed) != 0;
+        }
+        return pinned;
+    }
+
+private:
+    struct alignas(64) ReaderSlot {
+        std::atomic<std::uint64_t> epoch{0}; // 0 means the slot is free.
+    };
+
+    struct Retired {
+        std::uint64_t epoch;
+        void *object;
+        void (*deleter)(void *);
+    };
+
+    ReaderSlot readers[kMaxReaders];
+    std::atomic<std::uint64_t> global_epoch;
+    std::deque<Retired> retired; // only touched by the writer.
+};
+
+#endif //MYAVLTREE_EPOCHRECLAIMER_H
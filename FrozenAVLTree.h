@@ -0,0 +1,232 @@
+//
+// A read-only snapshot of an AVLTree, laid out for fast searching.
+//
+/**
+ * Frozen AVL Tree
+ * an immutable copy of the keys of an AVLTree (made by Freeze(tree), at the end of this file), that answers the same queries as the
+ * live tree without chasing pointers. the keys are stored twice:
+ *  - in a static B-tree: blocks of kBlockKeys keys (one cache line), where the children of block k are the
+ *    blocks k*(kBlockKeys+1)+1 ... k*(kBlockKeys+1)+kBlockKeys+1, so a search touches one cache line per level
+ *    and compares the key with a whole block at once using SIMD. (AVX2 or SSE2 if the compiler has them, defining
+ *    AVLTREE_FROZEN_SCALAR forces the plain loop, which the tests use to check it)
+ *  - as a sorted array of (key, value) entries, which makes Select O(1).
+ * the values are NOT copied, the entries point at the values owned by the tree, so the snapshot must not outlive
+ * the tree it was made from, and it does not see later changes to the tree.
+ * the following functions are available:
+ * find              - returns the entry with the received key, or nullptr.
+ *
+ * Rank              - returns the index(+1) of the key in sorted order, or -1 if it's not there. (like AVLTree::Rank)
+ *
+ * Select            - returns the entry at the received index(+1) in sorted order. (like AVLTree::Select)
+ *
+ * LowerBound        - returns the first entry with a key bigger or equal to the received key, or nullptr.
+ *
+ * Size              - the number of keys.
+ *
+ * Freeze            - makes the snapshot of an AVLTree. (a free function, so AVLTree.h doesn't need this header)
+ */
+
+#ifndef MYAVLTREE_FROZENAVLTREE_H
+#define MYAVLTREE_FROZENAVLTREE_H
+
+#include <climits>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if !defined(AVLTREE_FROZEN_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+template<class T>
+struct FrozenEntry {
+    int key;
+    T *value;
+};
+
+template<class T>
+class FrozenAVLTree {
+public:
+    static const int kBlockKeys = 16; // 16 ints = 64 bytes = one cache line.
+
+    FrozenAVLTree() : count(0), block_count(0), blocks(nullptr) {}
+
+    /**
+     * builds the snapshot from entries sorted by strictly increasing key.
+     * @param sorted_entries
+     */
+    explicit FrozenAVLTree(std::vector<FrozenEntry<T> > sorted_entries) : entries(std::move(sorted_entries)) {
+        count = static_cast<int>(entries.size());
+        block_count = (count + kBlockKeys - 1) / kBlockKeys;
+        // over-allocate so the blocks can start on a cache line boundary.
+        block_storage.assign(block_count * kBlockKeys + kBlockKeys, INT_MAX);
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(block_storage.data());
+        std::uintptr_t aligned = (address + 63) & ~static_cast<std::uintptr_t>(63);
+        blocks = block_storage.data() + (aligned - address) / sizeof(int);
+        ranks.assign(block_count * kBlockKeys, count);
+        int next = 0;
+        FillBlock(0, next);
+    }
+
+    FrozenAVLTree(FrozenAVLTree &&) = default;
+    FrozenAVLTree &operator=(FrozenAVLTree &&) = default;
+    FrozenAVLTree(const FrozenAVLTree &) = delete;
+    FrozenAVLTree &operator=(const FrozenAVLTree &) = delete;
+    //*********************************************************************
+    int Size() const {
+        return count;
+    }
+    //*********************************************************************
+    /**
+     * @param key
+     * @return the index (0 based) in sorted order of the first key that is bigger or equal to the received key,
+     * or Size() if there is no such key.
+     */
+    int LowerBoundIndex(int key) const {
+        int block = 0;
+        int candidate = count;
+        while (block < block_count) {
+            const int *keys = blocks + block * kBlockKeys;
+            int i = CountLess(keys, key);
+            if (i < kBlockKeys) {
+                candidate = ranks[block * kBlockKeys + i];
+            }
+            block = block * (kBlockKeys + 1) + i + 1;
+        }
+        return candidate;
+    }
+    //*********************************************************************
+    /**
+     * returns the first entry with a key bigger or equal to the received key, or nullptr if there isn't one.
+     * @param key
+     */
+    const FrozenEntry<T> *LowerBound(int key) const {
+        int index = LowerBoundIndex(key);
+        return index < count ? &entries[index] : nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the entry with the received key, or nullptr.
+     * @param key
+     */
+    const FrozenEntry<T> *find(int key) const {
+        const FrozenEntry<T> *entry = LowerBound(key);
+        return (entry && entry->key == key) ? entry : nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the index(+1) of the key if it was in a sorted array, or -1 if it's not there.
+     * @param key
+     */
+    int Rank(int key) const {
+        int index = LowerBoundIndex(key);
+        return (index < count && entries[index].key == key) ? index + 1 : -1;
+    }
+    //*********************************************************************
+    /**
+     * returns the entry at the received index(+1) in sorted order, or nullptr if the index is out of range.
+     * @param index
+     */
+    const FrozenEntry<T> *Select(int index) const {
+        if (index < 1 || index > count) return nullptr;
+        return &entries[index - 1];
+    }
+
+private:
+    std::vector<FrozenEntry<T> > entries;
+    int count;
+    int block_count;
+    std::vector<int> block_storage;
+    int *blocks;              // block_count * kBlockKeys keys, aligned to 64 bytes. unused slots hold INT_MAX.
+    std::vector<int> ranks;   // the index in entries of every block slot. unused slots hold count.
+
+    /**
+     * fills the blocks with the sorted keys by an in-order walk of the implicit B-tree, so the unused slots all
+     * end up at the end of the order.
+     * @param block - the current block.
+     * @param next - the index of the next entry to place.
+     */
+    void FillBlock(int block, int &next) {
+        if (block >= block_count) return;
+        for (int i = 0; i <= kBlockKeys; i++) {
+            FillBlock(block * (kBlockKeys + 1) + i + 1, next);
+            if (i < kBlockKeys && next < count) {
+                blocks[block * kBlockKeys + i] = entries[next].key;
+                ranks[block * kBlockKeys + i] = next;
+                next++;
+            }
+        }
+    }
+    //*********************************************************************
+    /**
+     * counts how many of the kBlockKeys keys of a block are smaller than the received key.
+     * @param keys - the first key of the block, 64 byte aligned.
+     * @param key
+     */
+    static int CountLessScalar(const int *keys, int key) {
+        int less = 0;
+        for (int i = 0; i < kBlockKeys; i++) {
+            less += keys[i] < key;
+        }
+        return less;
+    }
+
+    static int CountLess(const int *keys, int key) {
+#if defined(AVLTREE_FROZEN_SCALAR)
+        return CountLessScalar(keys, key);
+#elif defined(__AVX2__)
+        __m256i target = _mm256_set1_epi32(key);
+        __m256i low = _mm256_cmpgt_epi32(target, _mm256_load_si256(reinterpret_cast<const __m256i *>(keys)));
+        __m256i high = _mm256_cmpgt_epi32(target, _mm256_load_si256(reinterpret_cast<const __m256i *>(keys + 8)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(low))) |
+                        static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(high))) << 8;
+        return __builtin_popcount(mask);
+#elif defined(__SSE2__)
+        __m128i target = _mm_set1_epi32(key);
+        unsigned mask = 0;
+        for (int i = 0; i < kBlockKeys; i += 4) {
+            __m128i less = _mm_cmpgt_epi32(target, _mm_load_si128(reinterpret_cast<const __m128i *>(keys + i)));
+            mask |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(less))) << i;
+        }
+        return __builtin_popcount(mask);
+#else
+        return CountLessScalar(keys, key);
+#endif
+    }
+};
+
+//*********************************************************************
+/**
+ * appends the (key, value) pairs of the subtree to the received vector in sorted order.
+ * @param node - the root of the subtree.
+ * @param entries
+ */
+template<class Node, class T>
+void CollectFrozenEntries(Node *node, std::vector<FrozenEntry<T> > &entries) {
+    if (!node) return;
+    CollectFrozenEntries(node->left_son, entries);
+    entries.push_back(FrozenEntry<T>{node->key, &node->value});
+    CollectFrozenEntries(node->right_son, entries);
+}
+//*********************************************************************
+/**
+ * makes an immutable snapshot of an AVLTree, laid out for fast find/Rank/Select/LowerBound.
+ * the snapshot points at the values of the tree, so it must not be used after the tree is gone.
+ * @param tree - its tombstones are purged first.
+ * @return the snapshot.
+ */
+template<class Tree>
+FrozenAVLTree<typename Tree::mapped_type> Freeze(Tree &tree) {
+    typedef typename Tree::mapped_type T;
+    static_assert(std::is_same<typename Tree::key_type, int>::value && Tree::kIntegerKeys,
+                  "a snapshot is keyed by int, in the natural order");
+    static_assert(!Tree::augment_type::kMultiset, "a snapshot has one entry per key, it can't keep the multiplicities");
+    tree.DropTombstones();
+    std::vector<FrozenEntry<T> > entries;
+    entries.reserve(tree.size);
+    CollectFrozenEntries(tree.root, entries);
+    return FrozenAVLTree<T>(std::move(entries));
+}
+
+#endif //MYAVLTREE_FROZENAVLTREE_H
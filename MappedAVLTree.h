@@ -0,0 +1,452 @@
+//
+// An on-disk image of an AVLTree that is queried in place through mmap, without loading it.
+//
+/**
+ * Mapped AVL Tree
+ * the image is the tree itself, in pre-order: a header and then one fixed size record per node,
+ * {key, size of the left subtree, value}. the left son of the record at index i is at i + 1 and the right son at
+ * i + 1 + left_size, so find / Rank / Select walk down the records like they walk down the nodes, and the sizes
+ * of the subtrees (for Rank and Select) follow from the left sizes on the way down.
+ * - WriteImage(tree, path) writes it in one pre-order pass through a MappedAVLTreeWriter. the image is written to
+ *   path.tmp and renamed over path once it is complete, so a crash never leaves a half written image at path.
+ * - MappedAVLTree::Open maps a file, checks the header and the checksum of the records, and serves the queries
+ *   from the mapped pages. nothing is parsed and nothing is allocated per node.
+ * - BuildFromImage(tree, image) turns an image back into a mutable tree, with the same shape, in O(n).
+ * the values must be trivially copyable, they are written and read as raw bytes. the image is in the byte order
+ * of the machine that wrote it, and Open rejects an image from a machine with another byte order.
+ * the following functions are available:
+ * Open / Close      - maps / unmaps an image. Open returns false (and Error() says why) if the image is not valid.
+ *
+ * find              - returns the record with the received key, or nullptr.
+ *
+ * Rank / Select     - the same as in AVLTree.
+ *
+ * Size / Root       - the number of records, the record of the root. (index 0)
+ *
+ * WriteImage / BuildFromImage - an AVLTree to an image and back. (free functions, so AVLTree.h stays free of the
+ *                     POSIX headers and only the users of images include them)
+ */
+
+#ifndef MYAVLTREE_MAPPEDAVLTREE_H
+#define MYAVLTREE_MAPPEDAVLTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template<class T>
+struct MappedRecord {
+    int key;
+    std::uint32_t left_size; // the number of records in the left subtree.
+    T value;
+};
+
+struct MappedImageHeader {
+    static const std::uint32_t kVersion = 1;
+    static const std::uint32_t kByteOrder = 0x01020304;
+
+    char magic[8];                 // "AVLIMAGE"
+    std::uint32_t version;
+    std::uint32_t byte_order;      // kByteOrder as the writer stored it.
+    std::uint32_t record_size;
+    std::uint32_t value_size;
+    std::uint64_t count;
+    std::uint64_t records_checksum;
+    std::uint64_t header_checksum; // of all the fields above.
+    char reserved[16];             // pads the header to 64 bytes, so the records stay aligned.
+
+    static const char *Magic() {
+        return "AVLIMAGE";
+    }
+};
+
+//*********************************************************************
+/**
+ * a 64 bit checksum of a byte stream, fed in pieces of any size: the bytes are taken 8 at a time, every word is
+ * multiplied in and rotated (like the rounds of xxHash), and the length is mixed in at the end.
+ */
+class ImageChecksum {
+public:
+    ImageChecksum() : hash(0x9E3779B97F4A7C15ULL), pending(0), length(0) {}
+
+    void Update(const void *data, std::size_t bytes) {
+        const unsigned char *in = static_cast<const unsigned char *>(data);
+        length += bytes;
+        while (bytes && pending) {
+            word[pending++] = *in++;
+            bytes--;
+            if (pending == 8) {
+                Mix(word);
+                pending = 0;
+            }
+        }
+        for (; bytes >= 8; in += 8, bytes -= 8) {
+            Mix(in);
+        }
+        // less than 8 bytes are left, and nothing was pending if there are any.
+        std::memcpy(word + pending, in, bytes);
+        pending += static_cast<unsigned>(bytes);
+    }
+
+    std::uint64_t Digest() const {
+        std::uint64_t result = hash;
+        for (unsigned i = 0; i < pending; i++) {
+            result = Round(result, word[i]);
+        }
+        result ^= length;
+        result ^= result >> 33;
+        result *= 0xFF51AFD7ED558CCDULL;
+        result ^= result >> 33;
+        return result;
+    }
+
+private:
+    std::uint64_t hash;
+    unsigned char word[8];
+    unsigned pending;
+    std::uint64_t length;
+
+    static std::uint64_t Round(std::uint64_t hash, std::uint64_t input) {
+        hash += input * 0xC2B2AE3D27D4EB4FULL;
+        hash = (hash << 31) | (hash >> 33);
+        return hash * 0x9E3779B185EBCA87ULL;
+    }
+
+    void Mix(const unsigned char *bytes) {
+        std::uint64_t input;
+        std::memcpy(&input, bytes, 8);
+        hash = Round(hash, input);
+    }
+};
+
+inline std::uint64_t HeaderChecksum(const MappedImageHeader &header) {
+    ImageChecksum checksum;
+    checksum.Update(&header, offsetof(MappedImageHeader, header_checksum));
+    return checksum.Digest();
+}
+
+//*********************************************************************
+/**
+ * writes an image record by record, in pre-order. the number of records is fixed when the image is started.
+ */
+template<class T>
+class MappedAVLTreeWriter {
+public:
+    typedef MappedRecord<T> Record;
+    static_assert(std::is_trivially_copyable<T>::value, "the values of an image must be trivially copyable");
+
+    MappedAVLTreeWriter() : file(nullptr), count(0), written(0) {}
+
+    MappedAVLTreeWriter(const MappedAVLTreeWriter &) = delete;
+    MappedAVLTreeWriter &operator=(const MappedAVLTreeWriter &) = delete;
+
+    ~MappedAVLTreeWriter() {
+        if (file) { // never finished, drop the temporary file.
+            std::fclose(file);
+            std::remove(temporary_path.c_str());
+        }
+    }
+    //*********************************************************************
+    /**
+     * starts writing an image of count records to path.tmp.
+     * @return false if the file can't be created.
+     */
+    bool Start(const std::string &path, std::uint64_t records_count) {
+        final_path = path;
+        temporary_path = path + ".tmp";
+        count = records_count;
+        written = 0;
+        file = std::fopen(temporary_path.c_str(), "wb");
+        if (!file) return false;
+        MappedImageHeader placeholder = MappedImageHeader();
+        return std::fwrite(&placeholder, sizeof(placeholder), 1, file) == 1;
+    }
+    //*********************************************************************
+    bool Append(int key, std::uint32_t left_size, const T &value) {
+        Record record;
+        std::memset(&record, 0, sizeof(record)); // no garbage in the padding, it is part of the checksum.
+        record.key = key;
+        record.left_size = left_size;
+        std::memcpy(&record.value, &value, sizeof(T));
+        checksum.Update(&record, sizeof(record));
+        written++;
+        return std::fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    //*********************************************************************
+    /**
+     * writes the header, flushes the file to the disk and renames it to its final path.
+     * @return false if anything failed, or if the number of records is not the one given to Start.
+     */
+    bool Finish() {
+        MappedImageHeader header = MappedImageHeader();
+        std::memcpy(header.magic, MappedImageHeader::Magic(), sizeof(header.magic));
+        header.version = MappedImageHeader::kVersion;
+        header.byte_order = MappedImageHeader::kByteOrder;
+        header.record_size = sizeof(Record);
+        header.value_size = sizeof(T);
+        header.count = count;
+        header.records_checksum = checksum.Digest();
+        header.header_checksum = HeaderChecksum(header);
+        bool ok = written == count && std::fseek(file, 0, SEEK_SET) == 0 &&
+                  std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fflush(file) == 0 &&
+                  ::fsync(::fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+        if (ok) ok = std::rename(temporary_path.c_str(), final_path.c_str()) == 0;
+        if (!ok) std::remove(temporary_path.c_str());
+        return ok;
+    }
+
+private:
+    std::FILE *file;
+    std::string final_path;
+    std::string temporary_path;
+    std::uint64_t count;
+    std::uint64_t written;
+    ImageChecksum checksum;
+};
+
+//*********************************************************************
+template<class T>
+class MappedAVLTree {
+public:
+    typedef MappedRecord<T> Record;
+    static_assert(std::is_trivially_copyable<T>::value, "the values of an image must be trivially copyable");
+    static_assert(sizeof(MappedImageHeader) == 64, "the header must keep the records 64 byte aligned");
+
+    MappedAVLTree() : mapping(nullptr), mapped_bytes(0), records(nullptr), count(0) {}
+
+    MappedAVLTree(const MappedAVLTree &) = delete;
+    MappedAVLTree &operator=(const MappedAVLTree &) = delete;
+
+    ~MappedAVLTree() {
+        Close();
+    }
+    //*********************************************************************
+    /**
+     * maps the image at the received path read only.
+     * @param path
+     * @param verify_records - checks the checksum of all the records, which reads the whole file once. only skip
+     * it for a file that was already verified, a corrupt record can send the queries out of the image.
+     * @return true if the image is valid and mapped. otherwise nothing is mapped and Error() says what's wrong.
+     */
+    bool Open(const std::string &path, bool verify_records = true) {
+        Close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return Fail("can't open the file");
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || static_cast<std::uint64_t>(status.st_size) < sizeof(MappedImageHeader)) {
+            ::close(fd);
+            return Fail("the file is too short for a header");
+        }
+        mapped_bytes = static_cast<std::size_t>(status.st_size);
+        void *address = ::mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // the mapping keeps the file.
+        if (address == MAP_FAILED) {
+            mapped_bytes = 0;
+            return Fail("mmap failed");
+        }
+        mapping = address;
+        MappedImageHeader header;
+        std::memcpy(&header, mapping, sizeof(header));
+        const char *problem = CheckHeader(header);
+        if (!problem && verify_records) {
+            ImageChecksum checksum;
+            checksum.Update(static_cast<const char *>(mapping) + sizeof(header), header.count * sizeof(Record));
+            if (checksum.Digest() != header.records_checksum) problem = "the records don't match their checksum";
+        }
+        if (problem) {
+            Close();
+            return Fail(problem);
+        }
+        records = reinterpret_cast<const Record *>(static_cast<const char *>(mapping) + sizeof(header));
+        count = header.count;
+        return true;
+    }
+    //*********************************************************************
+    void Close() {
+        if (mapping) ::munmap(mapping, mapped_bytes);
+        mapping = nullptr;
+        mapped_bytes = 0;
+        records = nullptr;
+        count = 0;
+    }
+
+    const std::string &Error() const {
+        return error;
+    }
+
+    int Size() const {
+        return static_cast<int>(count);
+    }
+
+    const Record *Root() const {
+        return count ? records : nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the record with the received key, or nullptr.
+     * @param key
+     */
+    const Record *find(int key) const {
+        std::uint64_t index = 0;
+        std::uint64_t size = count; // the size of the subtree rooted at index.
+        while (size) {
+            const Record &record = records[index];
+            if (key == record.key) return &record;
+            if (key < record.key) {
+                size = record.left_size;
+                index++;
+            } else {
+                size -= record.left_size + 1;
+                index += record.left_size + 1;
+            }
+        }
+        return nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the index(+1) of the key if it was in a sorted array, or -1 if it's not there.
+     * @param key
+     */
+    int Rank(int key) const {
+        std::uint64_t r = 0;
+        std::uint64_t index = 0;
+        std::uint64_t size = count;
+        while (size) {
+            const Record &record = records[index];
+            if (key < record.key) {
+                size = record.left_size;
+                index++;
+                continue;
+            }
+            r += record.left_size + 1;
+            if (key == record.key) return static_cast<int>(r);
+            size -= record.left_size + 1;
+            index += record.left_size + 1;
+        }
+        return -1;
+    }
+    //*********************************************************************
+    /**
+     * returns the record at the received index(+1) in sorted order, or nullptr.
+     * @param index
+     */
+    const Record *Select(int index) const {
+        if (index < 1 || static_cast<std::uint64_t>(index) > count) return nullptr;
+        std::uint64_t position = 0;
+        std::uint64_t wanted = static_cast<std::uint64_t>(index);
+        while (true) {
+            const Record &record = records[position];
+            if (wanted <= record.left_size) {
+                position++;
+            } else if (wanted == record.left_size + 1) {
+                return &record;
+            } else {
+                wanted -= record.left_size + 1;
+                position += record.left_size + 1;
+            }
+        }
+    }
+
+private:
+    void *mapping;
+    std::size_t mapped_bytes;
+    const Record *records;
+    std::uint64_t count;
+    std::string error;
+
+    bool Fail(const char *reason) {
+        error = reason;
+        return false;
+    }
+
+    const char *CheckHeader(const MappedImageHeader &header) const {
+        if (std::memcmp(header.magic, MappedImageHeader::Magic(), sizeof(header.magic)) != 0) {
+            return "not an AVLTree image";
+        }
+        if (header.version != MappedImageHeader::kVersion) return "unsupported image version";
+        if (header.byte_order != MappedImageHeader::kByteOrder) return "the image has another byte order";
+        if (header.header_checksum != HeaderChecksum(header)) return "the header doesn't match its checksum";
+        if (header.record_size != sizeof(Record) || header.value_size != sizeof(T)) {
+            return "the image has another value type";
+        }
+        if (header.count > 0x7FFFFFFF ||
+            mapped_bytes != sizeof(MappedImageHeader) + header.count * sizeof(Record)) {
+            return "the file size doesn't match the number of records";
+        }
+        return nullptr;
+    }
+};
+
+//*********************************************************************
+/**
+ * appends the records of the subtree to the writer, in pre-order.
+ */
+template<class Tree>
+bool WriteImageNode(MappedAVLTreeWriter<typename Tree::mapped_type> &writer, const typename Tree::Node *node) {
+    if (!node) return true;
+    std::uint32_t left_size = static_cast<std::uint32_t>(Tree::augment_type::Count(node->left_son));
+    return writer.Append(node->key, left_size, node->value) && WriteImageNode<Tree>(writer, node->left_son) &&
+           WriteImageNode<Tree>(writer, node->right_son);
+}
+
+/**
+ * writes an AVLTree as an image in one pre-order pass. the values must be trivially copyable. (without the subtree
+ * sizes, counting the left subtrees makes it O(n log n) instead of O(n))
+ * @param tree - its tombstones are purged first.
+ * @param path - the image replaces the file at this path only once it is completely written.
+ * @return true if the image was written.
+ */
+template<class Tree>
+bool WriteImage(Tree &tree, const std::string &path) {
+    static_assert(std::is_same<typename Tree::key_type, int>::value && Tree::kIntegerKeys,
+                  "an image is keyed by int, in the natural order");
+    static_assert(!Tree::augment_type::kMultiset, "an image has one record per key, it can't keep the multiplicities");
+    tree.DropTombstones();
+    MappedAVLTreeWriter<typename Tree::mapped_type> writer;
+    return writer.Start(path, tree.size) && WriteImageNode<Tree>(writer, tree.root) && writer.Finish();
+}
+//*********************************************************************
+/**
+ * builds the subtree of count records that starts at the received record (its root, in pre-order).
+ */
+template<class Tree>
+typename Tree::Node *BuildImageNode(Tree &tree, const MappedRecord<typename Tree::mapped_type> *record,
+                                    std::uint32_t count) {
+    if (!count) return nullptr;
+    typename Tree::Node *node = tree.CreateNode(record->key, record->value);
+    std::uint32_t left_size = record->left_size;
+    node->left_son = BuildImageNode(tree, record + 1, left_size);
+    node->right_son = BuildImageNode(tree, record + 1 + left_size, count - left_size - 1);
+    if (node->left_son) node->left_son->parent = node;
+    if (node->right_son) node->right_son->parent = node;
+    tree.UpdateInfo(node);
+    return node;
+}
+
+/**
+ * replaces the content of an AVLTree with the content of a mapped image. the tree gets the shape that was
+ * written, so it is balanced without any rotation, and the records are read in file order.
+ * @param tree
+ * @param image - an open image, it can be closed afterwards.
+ */
+template<class Tree>
+void BuildFromImage(Tree &tree, const MappedAVLTree<typename Tree::mapped_type> &image) {
+    static_assert(std::is_same<typename Tree::key_type, int>::value && Tree::kIntegerKeys,
+                  "an image is keyed by int, in the natural order");
+    tree.ClearTree(tree.root);
+    tree.size = image.Size();
+    tree.root = BuildImageNode(tree, image.Root(), static_cast<std::uint32_t>(tree.size));
+    if (tree.root) tree.root->parent = nullptr;
+    tree.ResetCachedNodes();
+}
+
+#endif //MYAVLTREE_MAPPEDAVLTREE_H
@@ -0,0 +1,347 @@
+//
+// A persistent (path copying) AVL tree, for many lock free readers and one writer at a time.
+//
+/**
+ * Persistent AVL Tree
+ * the nodes are never changed once they are published. AddNode and RemoveNode copy only the nodes on the path
+ * from the root to the changed node (plus the few nodes touched by rotations) and then publish the new root with
+ * one atomic store, so every root ever published stays a consistent version of the tree.
+ * readers call Pin() and get a Snapshot: a version that stays valid, without any lock, for as long as the snapshot
+ * lives. the nodes that are not part of the newest version are reclaimed with an EpochReclaimer once no snapshot
+ * can reach them anymore. every write reclaims what it can, and Reclaim / TryReclaim do it between the writes: the
+ * nodes replaced by the last write are only freed by a later call once the snapshots that saw them are gone.
+ * unlike AVLTree, the keys are ints and the values are not stored in the nodes: a node owns a T* that AddNode
+ * takes over and that is deleted with the last node that points at it. (the versions share the values, so a new
+ * version copies the pointer, not the value) the nodes are ranked (additional_info is the size of the subtree),
+ * and they have no parent pointers, because a shared node has no single parent.
+ * the following functions are available:
+ * Pin               - returns a snapshot of the newest version. (readers, any number of threads)
+ *
+ * AddNode           - adds a key and a value in a new version. (writers, serialized by a mutex)
+ *
+ * RemoveNode        - removes a key in a new version. (writers, serialized by a mutex)
+ *
+ * Reclaim           - frees the replaced nodes that no snapshot can reach anymore, without a write. (the owner,
+ *                     after the last write. TryReclaim does the same unless a writer is busy, for the readers)
+ *
+ * Snapshot::find / Rank / Select / Size - the same as in AVLTree, on the pinned version.
+ */
+
+#ifndef MYAVLTREE_PERSISTENTAVLTREE_H
+#define MYAVLTREE_PERSISTENTAVLTREE_H
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <vector>
+#include "EpochReclaimer.h"
+
+template<class T>
+struct PersistentAVLNode {
+    int key;
+    T *value;
+    const PersistentAVLNode<T> *left_son;
+    const PersistentAVLNode<T> *right_son;
+    int height;
+    int additional_info; // the size of the subtree.
+};
+
+template<class T>
+class PersistentAVLTree {
+    typedef PersistentAVLNode<T> Node;
+
+public:
+    //*********************************************************************
+    /**
+     * a pinned version of the tree. it can be used from one thread without any lock, and the version it sees does
+     * not change.
+     */
+    class Snapshot {
+    public:
+        Snapshot(EpochReclaimer::Guard guard, const Node *root) : guard(std::move(guard)), root(root) {}
+
+        int Size() const {
+            return root ? root->additional_info : 0;
+        }
+        //*********************************************************************
+        const Node *find(int key) const {
+            const Node *current = root;
+            while (current) {
+                if (key < current->key) {
+                    current = current->left_son;
+                } else if (key > current->key) {
+                    current = current->right_son;
+                } else return current;
+            }
+            return nullptr;
+        }
+        //*********************************************************************
+        /**
+         * returns the index(+1) of the node with the matching key if it was in a sorted array, or -1.
+         */
+        int Rank(int key) const {
+            int r = 0;
+            const Node *current = root;
+            while (current) {
+                if (key < current->key) {
+                    current = current->left_son;
+                    continue;
+                }
+                r = r + (current->left_son ? current->left_son->additional_info : 0) + 1;
+                if (key == current->key) return r;
+                current = current->right_son;
+            }
+            return -1;
+        }
+        //*********************************************************************
+        /**
+         * returns the node at the received index(+1) in sorted order, or nullptr.
+         */
+        const Node *Select(int index) const {
+            const Node *current = root;
+            while (current) {
+                int left_size = current->left_son ? current->left_son->additional_info : 0;
+                if (index <= left_size) {
+                    current = current->left_son;
+                } else if (index == left_size + 1) {
+                    return current;
+                } else {
+                    index = index - left_size - 1;
+                    current = current->right_son;
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        EpochReclaimer::Guard guard;
+        const Node *root;
+    };
+
+    PersistentAVLTree() : root(nullptr) {}
+
+    PersistentAVLTree(const PersistentAVLTree &) = delete;
+    PersistentAVLTree &operator=(const PersistentAVLTree &) = delete;
+
+    // no snapshot may be alive anymore at this point. (checked in debug builds)
+    ~PersistentAVLTree() {
+        assert(reclaimer.PinnedCount() == 0 && "a PersistentAVLTree is destroyed while a snapshot is alive");
+        ClearTree(root.load());
+    }
+    //*********************************************************************
+    /**
+     * pins the newest version of the tree.
+     */
+    Snapshot Pin() {
+        EpochReclaimer::Guard guard = reclaimer.Pin();
+        return Snapshot(std::move(guard), root.load(std::memory_order_seq_cst));
+    }
+    //*********************************************************************
+    /**
+     * publishes a new version with the received key and value.
+     * @return true if added. if the key was already there nothing changes, and the caller keeps the value.
+     */
+    bool AddNode(int key, T *value) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        bool added = false;
+        const Node *new_root = Insert(root.load(std::memory_order_relaxed), key, value, added);
+        if (added) Publish(new_root);
+        return added;
+    }
+    //*********************************************************************
+    /**
+     * publishes a new version without the received key. its value is deleted once no snapshot can see it.
+     * @return true if the key was found.
+     */
+    bool RemoveNode(int key) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        bool removed = false;
+        const Node *new_root = Remove(root.load(std::memory_order_relaxed), key, removed);
+        if (removed) Publish(new_root);
+        return removed;
+    }
+    //*********************************************************************
+    /**
+     * moves the reclaimer to the next epoch and frees the replaced nodes (and values) that no snapshot can reach,
+     * the way every write does. without it the nodes replaced by the last write would wait for the next write.
+     * @return the number of replaced nodes that are still waiting for old snapshots to go away.
+     */
+    int Reclaim() {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        reclaimer.Advance();
+        return reclaimer.PendingCount();
+    }
+
+    /**
+     * the same as Reclaim, but it never waits: if a writer holds the mutex it returns false right away (the
+     * writer reclaims when it publishes). a reader can call it after releasing its snapshot.
+     */
+    bool TryReclaim() {
+        std::unique_lock<std::mutex> lock(writer_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return false;
+        reclaimer.Advance();
+        return true;
+    }
+    //*********************************************************************
+    // the number of replaced nodes that are still waiting for old snapshots to go away.
+    int PendingCount() {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        return reclaimer.PendingCount() + static_cast<int>(replaced.size());
+    }
+
+private:
+    std::atomic<const Node *> root;
+    std::mutex writer_mutex;
+    EpochReclaimer reclaimer;
+    // the nodes left out of the version that is being built, each with whether its value goes with it.
+    std::vector<std::pair<const Node *, bool> > replaced;
+
+    static void DeleteNode(void *node) {
+        delete static_cast<Node *>(node);
+    }
+
+    static void DeleteNodeAndValue(void *node) {
+        Node *dead = static_cast<Node *>(node);
+        delete dead->value;
+        delete dead;
+    }
+
+    void ClearTree(const Node *node) {
+        if (!node) return;
+        ClearTree(node->left_son);
+        ClearTree(node->right_son);
+        DeleteNodeAndValue(const_cast<Node *>(node));
+    }
+    //*********************************************************************
+    /**
+     * stores the new root and hands the nodes it no longer uses to the reclaimer.
+     */
+    void Publish(const Node *new_root) {
+        root.store(new_root, std::memory_order_seq_cst);
+        for (const std::pair<const Node *, bool> &node : replaced) {
+            reclaimer.Retire(const_cast<Node *>(node.first), node.second ? DeleteNodeAndValue : DeleteNode);
+        }
+        replaced.clear();
+        reclaimer.Advance();
+    }
+    //*********************************************************************
+    int Height(const Node *node) {
+        return node ? node->height : -1;
+    }
+
+    int Size(const Node *node) {
+        return node ? node->additional_info : 0;
+    }
+    //*********************************************************************
+    /**
+     * creates a new node over the received sons. (the sons must be balanced with each other)
+     */
+    const Node *MakeNode(int key, T *value, const Node *left, const Node *right) {
+        int height = (Height(left) > Height(right) ? Height(left) : Height(right)) + 1;
+        return new Node{key, value, left, right, height, Size(left) + Size(right) + 1};
+    }
+    //*********************************************************************
+    /**
+     * the node that replaces 'node' is not published yet, so 'node' itself can only be freed through the reclaimer.
+     */
+    void Replace(const Node *node, bool with_value = false) {
+        replaced.push_back(std::make_pair(node, with_value));
+    }
+    //*********************************************************************
+    /**
+     * creates a node over sons whose heights differ by at most 2, and does the rotations (by copying the rotated
+     * nodes) if they are not balanced.
+     */
+    const Node *Balance(int key, T *value, const Node *left, const Node *right) {
+        if (Height(left) > Height(right) + 1) {
+            if (Height(left->left_son) >= Height(left->right_son)) { // LL
+                Replace(left);
+                return MakeNode(left->key, left->value, left->left_son,
+                                MakeNode(key, value, left->right_son, right));
+            }
+            const Node *middle = left->right_son; // LR
+            Replace(left);
+            Replace(middle);
+            return MakeNode(middle->key, middle->value,
+                            MakeNode(left->key, left->value, left->left_son, middle->left_son),
+                            MakeNode(key, value, middle->right_son, right));
+        }
+        if (Height(right) > Height(left) + 1) {
+            if (Height(right->right_son) >= Height(right->left_son)) { // RR
+                Replace(right);
+                return MakeNode(right->key, right->value, MakeNode(key, value, left, right->left_son),
+                                right->right_son);
+            }
+            const Node *middle = right->left_son; // RL
+            Replace(right);
+            Replace(middle);
+            return MakeNode(middle->key, middle->value, MakeNode(key, value, left, middle->left_son),
+                            MakeNode(right->key, right->value, middle->right_son, right->right_son));
+        }
+        return MakeNode(key, value, left, right);
+    }
+    //*********************************************************************
+    /**
+     * returns the root of a copy of the subtree with the key added. nothing is copied if the key is already there.
+     */
+    const Node *Insert(const Node *node, int key, T *value, bool &added) {
+        if (!node) {
+            added = true;
+            return MakeNode(key, value, nullptr, nullptr);
+        }
+        if (key == node->key) return node;
+        if (key < node->key) {
+            const Node *left = Insert(node->left_son, key, value, added);
+            if (!added) return node;
+            Replace(node);
+            return Balance(node->key, node->value, left, node->right_son);
+        }
+        const Node *right = Insert(node->right_son, key, value, added);
+        if (!added) return node;
+        Replace(node);
+        return Balance(node->key, node->value, node->left_son, right);
+    }
+    //*********************************************************************
+    /**
+     * returns the root of a copy of the subtree without its smallest node.
+     * @param min - receives the removed node, whose key and value move to a new node.
+     */
+    const Node *RemoveMin(const Node *node, const Node *&min) {
+        Replace(node);
+        if (!node->left_son) {
+            min = node;
+            return node->right_son;
+        }
+        const Node *left = RemoveMin(node->left_son, min);
+        return Balance(node->key, node->value, left, node->right_son);
+    }
+    //*********************************************************************
+    /**
+     * returns the root of a copy of the subtree without the key. nothing is copied if the key is not there.
+     */
+    const Node *Remove(const Node *node, int key, bool &removed) {
+        if (!node) return nullptr;
+        if (key < node->key) {
+            const Node *left = Remove(node->left_son, key, removed);
+            if (!removed) return node;
+            Replace(node);
+            return Balance(node->key, node->value, left, node->right_son);
+        }
+        if (key > node->key) {
+            const Node *right = Remove(node->right_son, key, removed);
+            if (!removed) return node;
+            Replace(node);
+            return Balance(node->key, node->value, node->left_son, right);
+        }
+        removed = true;
+        Replace(node, true);
+        if (!node->left_son) return node->right_son;
+        if (!node->right_son) return node->left_son;
+        // the in-order successor takes the place of the removed node.
+        const Node *successor = nullptr;
+        const Node *right = RemoveMin(node->right_son, successor);
+        return Balance(successor->key, successor->value, node->left_son, right);
+    }
+};
+
+#endif //MYAVLTREE_PERSISTENTAVLTREE_H
@@ -0,0 +1,281 @@
+//
+// A concurrent ordered map made of AVLTree shards, each owning a range of keys and locked on its own.
+//
+/**
+ * Sharded AVL Tree
+ * the key space is cut into ranges, and every range is an AVLTree (a shard) with its own reader-writer lock, so
+ * writers of different ranges don't wait for each other. the shards are kept in key order, which keeps the
+ * ordered operations (Rank, Select, ForEach) simple: they go through the shards in order and add up their sizes.
+ * the shards adapt to the keys: a shard that grows past max_shard_size is split in the middle (AVLTree::Split, in
+ * O(log n)), and a shard that shrinks to a quarter of it is joined with its smaller neighbour (AVLTree::Join) if
+ * the two are small enough together.
+ * locking: the list of shards has a reader-writer lock of its own. every operation holds it shared and locks the
+ * shards it uses (always in key order, a writer only ever locks one), only a split or a join holds it exclusively.
+ * (so a Rank or a Select can hold a lock on every shard. under ThreadSanitizer, past 63 shards, that takes
+ * TSAN_OPTIONS=detect_deadlocks=0: the deadlock detector can't track more locks held by one thread)
+ * every shard keeps its size in an atomic next to the tree, and the whole tree keeps a running total, so Size and
+ * the check of a remove for a join read them without any shard lock.
+ * the shards use NewDeleteAllocator: a split leaves two shards with nodes from the same place, and the pool of
+ * AVLNodePool is not safe to use from two shards locked by different threads.
+ * the values are copied out under the lock (Find returns no pointer), since a node may be gone right after.
+ * the following functions are available:
+ * AddNode / Emplace - adds a key and a value, returns false if the key was already there.
+ *
+ * RemoveNode        - removes a key, returns false if it was not there.
+ *
+ * Find / Contains   - copies the value of a key out / checks if a key is there.
+ *
+ * Rank / Select     - the same as in AVLTree, over all the shards. (consistent: the shards they count are locked)
+ *
+ * ForEach           - calls a function on every (key, value) in key order, one shard at a time. (every shard is
+ *                     seen at one point in time, the shards are not seen at the same point in time)
+ *
+ * Size / ShardCount
+ */
+
+#ifndef MYAVLTREE_SHARDEDAVLTREE_H
+#define MYAVLTREE_SHARDEDAVLTREE_H
+
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include "AVLTree.h"
+
+template<class T>
+class ShardedAVLTree {
+public:
+    typedef AVLTree<T, NewDeleteAllocator> Tree;
+    static const int kDefaultMaxShardSize = 1 << 16;
+
+    explicit ShardedAVLTree(int max_shard_size = kDefaultMaxShardSize) : max_shard_size(max_shard_size), total(0) {
+        shards.emplace_back(new Shard(INT_MIN));
+    }
+
+    ShardedAVLTree(const ShardedAVLTree &) = delete;
+    ShardedAVLTree &operator=(const ShardedAVLTree &) = delete;
+    //*********************************************************************
+    /**
+     * adds a key with a value constructed from the received arguments.
+     * @return true if added, false if the key was already there.
+     */
+    template<class... Args>
+    bool Emplace(int key, Args &&... args) {
+        bool added;
+        bool too_big;
+        {
+            std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+            Shard &shard = FindShard(key);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            added = shard.tree.Emplace(key, std::forward<Args>(args)...).second;
+            if (added) shard.Resized(total);
+            too_big = shard.tree.size > max_shard_size;
+        }
+        if (too_big) SplitShard(key);
+        return added;
+    }
+
+    bool AddNode(int key, T value) {
+        return Emplace(key, std::move(value));
+    }
+    //*********************************************************************
+    /**
+     * @return true if the key was there.
+     */
+    bool RemoveNode(int key) {
+        bool removed;
+        bool too_small;
+        {
+            std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+            std::size_t index = ShardIndex(key);
+            Shard &shard = *shards[index];
+            {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                int old_size = shard.tree.size;
+                shard.tree.RemoveNode(key);
+                removed = shard.tree.size != old_size;
+                if (removed) shard.Resized(total);
+            }
+            // the directory is only taken exclusively if a join is likely to happen.
+            too_small = removed && shard.size.load() <= max_shard_size / 4 && CanJoin(index);
+        }
+        if (too_small) JoinShard(key);
+        return removed;
+    }
+    //*********************************************************************
+    /**
+     * copies the value of the received key.
+     * @return true if the key was found. (the value is not touched otherwise)
+     */
+    bool Find(int key, T &value) const {
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        Shard &shard = FindShard(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        typename Tree::Node *node = shard.tree.find(key);
+        if (!node) return false;
+        value = node->value;
+        return true;
+    }
+
+    bool Contains(int key) const {
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        Shard &shard = FindShard(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.tree.find(key) != nullptr;
+    }
+    //*********************************************************************
+    /**
+     * returns the index(+1) of the key in sorted order, or -1. the shard of the key and all the shards before it
+     * are locked for reading, in order, and stay locked until the count is done, so the answer is the rank at one
+     * point in time. the writers of the shards after it are not stopped.
+     * @param key
+     */
+    int Rank(int key) const {
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        std::size_t target = ShardIndex(key);
+        std::vector<std::shared_lock<std::shared_mutex> > locks;
+        locks.reserve(target + 1);
+        int before = 0;
+        for (std::size_t i = 0; i < target; i++) {
+            locks.emplace_back(shards[i]->mutex);
+            before += shards[i]->tree.size;
+        }
+        locks.emplace_back(shards[target]->mutex);
+        int rank = shards[target]->tree.Rank(key);
+        return rank < 0 ? -1 : before + rank;
+    }
+    //*********************************************************************
+    /**
+     * copies the key and the value at the received index(+1) in sorted order.
+     * @return false if the index is out of range.
+     */
+    bool Select(int index, int &key, T &value) const {
+        if (index < 1) return false;
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        std::vector<std::shared_lock<std::shared_mutex> > locks; // (as in Rank, up to the shard of the index)
+        for (const std::unique_ptr<Shard> &shard : shards) {
+            locks.emplace_back(shard->mutex);
+            if (index <= shard->tree.size) {
+                typename Tree::Node *node = shard->tree.Select(index);
+                key = node->key;
+                value = node->value;
+                return true;
+            }
+            index -= shard->tree.size;
+        }
+        return false;
+    }
+    //*********************************************************************
+    /**
+     * calls function(key, value) on every entry in key order, with the shard of the entry locked for reading.
+     * the function must not call back into this tree.
+     */
+    template<class Function>
+    void ForEach(Function function) const {
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        for (const std::unique_ptr<Shard> &shard : shards) {
+            std::shared_lock<std::shared_mutex> lock(shard->mutex);
+            for (typename Tree::iterator it = shard->tree.begin(); it != shard->tree.end(); ++it) {
+                function(it->key, static_cast<const T &>(it->value));
+            }
+        }
+    }
+    //*********************************************************************
+    // the running total of the shards, without any lock.
+    int Size() const {
+        return total.load();
+    }
+
+    int ShardCount() const {
+        std::shared_lock<std::shared_mutex> directory_lock(directory_mutex);
+        return static_cast<int>(shards.size());
+    }
+
+private:
+    struct Shard {
+        explicit Shard(int low) : low(low), size(0) {}
+
+        int low; // the smallest key of the range, the range ends where the next shard starts.
+        mutable std::shared_mutex mutex;
+        mutable Tree tree; // (the tree's queries are not const, they are made under the shared lock)
+        std::atomic<int> size; // tree.size, readable without the lock.
+
+        // publishes the size of the tree after a change (under the lock of the shard), and adds the change to total.
+        void Resized(std::atomic<int> &total) {
+            total += tree.size - size.exchange(tree.size);
+        }
+    };
+
+    int max_shard_size;
+    std::atomic<int> total; // the sum of the sizes of the shards.
+    mutable std::shared_mutex directory_mutex;
+    std::vector<std::unique_ptr<Shard> > shards; // sorted by low, the first one starts at INT_MIN.
+
+    /**
+     * the index of the shard whose range has the key. (the directory must be locked)
+     */
+    std::size_t ShardIndex(int key) const {
+        std::size_t low = 0, high = shards.size();
+        while (high - low > 1) {
+            std::size_t middle = (low + high) / 2;
+            if (shards[middle]->low <= key) low = middle;
+            else high = middle;
+        }
+        return low;
+    }
+
+    Shard &FindShard(int key) const {
+        return *shards[ShardIndex(key)];
+    }
+    //*********************************************************************
+    /**
+     * true if the shard at the index has a neighbour that it fits with in half of max_shard_size. (the directory
+     * must be locked, the sizes are read from the atomics and JoinShard checks again)
+     */
+    bool CanJoin(std::size_t index) const {
+        int own = shards[index]->size.load();
+        if (index > 0 && own + shards[index - 1]->size.load() <= max_shard_size / 2) return true;
+        return index + 1 < shards.size() && own + shards[index + 1]->size.load() <= max_shard_size / 2;
+    }
+    //*********************************************************************
+    /**
+     * splits the shard of the key in the middle, if it is still too big once the directory is locked.
+     */
+    void SplitShard(int key) {
+        std::unique_lock<std::shared_mutex> directory_lock(directory_mutex);
+        std::size_t index = ShardIndex(key);
+        Shard &shard = *shards[index];
+        if (shard.tree.size <= max_shard_size) return;
+        int middle_key = shard.tree.Select(shard.tree.size / 2)->key;
+        std::unique_ptr<Shard> right(new Shard(middle_key + 1));
+        shard.tree.Split(middle_key, right->tree);
+        shard.Resized(total);
+        right->Resized(total);
+        shards.insert(shards.begin() + index + 1, std::move(right));
+    }
+    //*********************************************************************
+    /**
+     * joins the shard of the key with the smaller of its neighbours, if the two still fit in half of
+     * max_shard_size together once the directory is locked.
+     */
+    void JoinShard(int key) {
+        std::unique_lock<std::shared_mutex> directory_lock(directory_mutex);
+        if (shards.size() < 2) return;
+        std::size_t index = ShardIndex(key);
+        std::size_t left = index;
+        if (index + 1 == shards.size() ||
+            (index > 0 && shards[index - 1]->tree.size < shards[index + 1]->tree.size)) {
+            left = index - 1;
+        }
+        if (shards[left]->tree.size + shards[left + 1]->tree.size > max_shard_size / 2) return;
+        shards[left]->tree.Join(shards[left + 1]->tree);
+        shards[left]->Resized(total);
+        shards[left + 1]->Resized(total);
+        shards.erase(shards.begin() + left + 1);
+    }
+};
+
+#endif //MYAVLTREE_SHARDEDAVLTREE_H
@@ -0,0 +1,207 @@
+//
+// A small fork-join thread pool used by the parallel AVLTree algorithms.
+//
+/**
+ * ThreadPool        - a fixed set of worker threads that run the submitted tasks.
+ *                     DefaultThreadPool() returns a pool shared by the whole program, sized to the machine.
+ *
+ * TaskGroup         - a set of tasks that can be waited for together. a thread that waits on a group keeps
+ *                     running pending tasks from the pool in the meantime, so nested fork-join never deadlocks
+ *                     even if every worker is itself waiting. with nothing left to run it sleeps until the
+ *                     group is done.
+ *
+ * ParallelInvoke    - runs two functions, the first one on the pool and the second one on the calling thread,
+ *                     and returns when both are done.
+ *
+ * ParallelSort      - a parallel merge sort on a random access range.
+ *
+ * ParallelStableSort - the same, but equal elements keep their order.
+ */
+
+#ifndef MYAVLTREE_THREADPOOL_H
+#define MYAVLTREE_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency()) : stopping(false) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+    //*********************************************************************
+    int Size() const {
+        return static_cast<int>(workers.size());
+    }
+    //*********************************************************************
+    void Submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wakeup.notify_one();
+    }
+    //*********************************************************************
+    /**
+     * runs one pending task on the calling thread, if there is one.
+     * @return true if a task was run.
+     */
+    bool RunPendingTask() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) return false;
+            task = std::move(tasks.back()); // newest first, it is the most likely to be in the cache.
+            tasks.pop_back();
+        }
+        task();
+        return true;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping;
+
+    void WorkerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return; // stopping, and nothing left to run.
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+//*********************************************************************
+inline ThreadPool &DefaultThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+//*********************************************************************
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool = DefaultThreadPool()) : pool(pool), pending(0) {}
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    ~TaskGroup() {
+        Wait();
+    }
+
+    template<class Function>
+    void Run(Function function) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.Submit([this, function]() mutable {
+            function();
+            // (under the mutex, so a waiter can't see the group done and destroy it while it's being signalled)
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.fetch_sub(1, std::memory_order_release) == 1) done.notify_all();
+        });
+    }
+
+    // waits for all the tasks of the group, and helps the pool with its pending tasks while waiting. when there
+    // is nothing left to help with, sleeps until the last task of the group signals.
+    void Wait() {
+        while (pending.load(std::memory_order_acquire) != 0) {
+            if (!pool.RunPendingTask()) {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex); // (the last task may still be holding it)
+    }
+
+private:
+    ThreadPool &pool;
+    std::atomic<int> pending;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+//*********************************************************************
+template<class First, class Second>
+void ParallelInvoke(First first, Second second, ThreadPool &pool = DefaultThreadPool()) {
+    TaskGroup group(pool);
+    group.Run(first);
+    second();
+    group.Wait();
+}
+
+//*********************************************************************
+/**
+ * sorts [first, last) by splitting it in halves that are sorted in parallel and then merged.
+ * ranges shorter than kSerialCutoff are sorted with std::sort.
+ */
+template<class Iterator, class Compare>
+void ParallelSort(Iterator first, Iterator last, Compare compare, ThreadPool &pool = DefaultThreadPool()) {
+    const std::ptrdiff_t kSerialCutoff = 1 << 14;
+    std::ptrdiff_t count = std::distance(first, last);
+    if (count < kSerialCutoff || pool.Size() < 2) {
+        std::sort(first, last, compare);
+        return;
+    }
+    Iterator middle = first + count / 2;
+    ParallelInvoke([&] { ParallelSort(first, middle, compare, pool); },
+                   [&] { ParallelSort(middle, last, compare, pool); }, pool);
+    std::inplace_merge(first, middle, last, compare);
+}
+
+template<class Iterator>
+void ParallelSort(Iterator first, Iterator last, ThreadPool &pool = DefaultThreadPool()) {
+    ParallelSort(first, last, std::less<typename std::iterator_traits<Iterator>::value_type>(), pool);
+}
+
+//*********************************************************************
+/**
+ * like ParallelSort, but equal elements keep their order: the short ranges are sorted with std::stable_sort
+ * (std::inplace_merge already keeps the elements of the first half first).
+ */
+template<class Iterator, class Compare>
+void ParallelStableSort(Iterator first, Iterator last, Compare compare, ThreadPool &pool = DefaultThreadPool()) {
+    const std::ptrdiff_t kSerialCutoff = 1 << 14;
+    std::ptrdiff_t count = std::distance(first, last);
+    if (count < kSerialCutoff || pool.Size() < 2) {
+        std::stable_sort(first, last, compare);
+        return;
+    }
+    Iterator middle = first + count / 2;
+    ParallelInvoke([&] { ParallelStableSort(first, middle, compare, pool); },
+                   [&] { ParallelStableSort(middle, last, compare, pool); }, pool);
+    std::inplace_merge(first, middle, last, compare);
+}
+
+#endif //MYAVLTREE_THREADPOOL_H
@@ -0,0 +1,558 @@
+//
+// The main benchmark: AVLTree, CompactAVLTree and BucketedAVLTree against std::map, std::set and the frozen
+// snapshot, on several key streams and sizes.
+// built by bench/CMakeLists.txt
+// usage: AVLBench [--sizes 1K,10K,100K,1M] [--workloads uniform,sequential,reverse,zipf] [--format csv|json]
+//                 [--seed N] [--zipf-theta 0.99]
+//
+/**
+ * for every structure, workload and size the benchmark runs these ops, n of each:
+ * insert            - AddNode / insert of every key, in the insert order of the workload.
+ * find              - lookups of the query stream.
+ * rank / select     - Rank of the query stream, and Select of the index of every query. (the AVL trees only)
+ * traverse          - a full in-order walk with the iterators, one op per visited node. (no latency)
+ * erase             - RemoveNode / erase of every key.
+ *
+ * the workloads: the keys are always 0, 8, 16, ... (8 * (n - 1)), so the index of a key is key / 8 + 1.
+ * uniform           - inserted and erased in random orders, queried with uniformly random keys.
+ * sequential        - inserted, queried and erased in increasing order.
+ * reverse           - inserted, queried and erased in decreasing order.
+ * zipf              - like uniform, but the queries are zipf distributed (theta 0.99 by default) over the keys, so
+ *                     a few hot keys get most of the lookups. the hot keys are spread over the whole tree.
+ *
+ * ops_per_sec is measured on a pass without any per-op timing. the latencies come from a second pass that times
+ * (a sample of at most kMaxSamples of) the ops one by one, so they include the cost of reading the clock, ~20ns.
+ * bytes_per_entry is the memory the structure took from operator new after the inserts, divided by n, including
+ * the int value of each entry.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../AVLTree.h"
+#include "../BucketedAVLTree.h"
+#include "../CompactAVLTree.h"
+#include "../FrozenAVLTree.h"
+
+//*********************************************************************
+// every allocation of the process goes through here, so the benchmark can tell how much memory a structure holds.
+static std::atomic<long long> live_bytes(0);
+static const std::size_t kHeader = 16; // keeps the 16 byte alignment of malloc.
+
+void *operator new(std::size_t size) {
+    char *block = static_cast<char *>(std::malloc(size + kHeader));
+    if (!block) throw std::bad_alloc();
+    std::memcpy(block, &size, sizeof(size));
+    live_bytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+    return block + kHeader;
+}
+
+void operator delete(void *pointer) noexcept {
+    if (!pointer) return;
+    char *block = static_cast<char *>(pointer) - kHeader;
+    std::size_t size;
+    std::memcpy(&size, block, sizeof(size));
+    live_bytes.fetch_sub(static_cast<long long>(size), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+//*********************************************************************
+typedef std::chrono::steady_clock Clock;
+static const int kMaxSamples = 1 << 20;
+static volatile long long sink; // keeps the results of the queries alive.
+
+struct Result {
+    std::string structure;
+    std::string workload;
+    long long size;
+    std::string op;
+    double ops_per_sec;
+    bool has_latency;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+    double bytes_per_entry;
+};
+
+struct Workload {
+    std::string name;
+    std::vector<int> insert_order;
+    std::vector<int> queries;
+    std::vector<int> erase_order;
+};
+
+/**
+ * zipf distributed ranks in [0, n), the generator of Gray et al, "Quickly generating billion-record synthetic
+ * databases". O(n) to set up, O(1) per draw.
+ */
+class ZipfGenerator {
+public:
+    ZipfGenerator(long long n, double theta) : n(n), theta(theta) {
+        zeta_n = Zeta(n, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) / (1.0 - Zeta(2, theta) / zeta_n);
+    }
+
+    template<class Generator>
+    long long operator()(Generator &generator) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+        double uz = u * zeta_n;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return n > 1 ? 1 : 0;
+        long long rank = static_cast<long long>(static_cast<double>(n) * std::pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+
+private:
+    long long n;
+    double theta, zeta_n, alpha, eta;
+
+    static double Zeta(long long n, double theta) {
+        double sum = 0;
+        for (long long i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+};
+
+Workload MakeWorkload(const std::string &name, int n, unsigned seed, double theta) {
+    std::mt19937_64 generator(seed);
+    Workload workload;
+    workload.name = name;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = 8 * i;
+    }
+    if (name == "sequential") {
+        workload.insert_order = keys;
+        workload.queries = keys;
+        workload.erase_order = keys;
+    } else if (name == "reverse") {
+        std::reverse(keys.begin(), keys.end());
+        workload.insert_order = keys;
+        workload.queries = keys;
+        workload.erase_order = keys;
+    } else {
+        std::shuffle(keys.begin(), keys.end(), generator);
+        workload.insert_order = keys;
+        workload.queries.resize(n);
+        if (name == "zipf") {
+            // rank r of the distribution is the r-th inserted key, which is a random key.
+            ZipfGenerator zipf(n, theta);
+            for (int i = 0; i < n; i++) {
+                workload.queries[i] = keys[zipf(generator)];
+            }
+        } else {
+            std::uniform_int_distribution<int> pick(0, n - 1);
+            for (int i = 0; i < n; i++) {
+                workload.queries[i] = 8 * pick(generator);
+            }
+        }
+        std::shuffle(keys.begin(), keys.end(), generator);
+        workload.erase_order = keys;
+    }
+    return workload;
+}
+
+//*********************************************************************
+/**
+ * the structures, behind the same small interface. the AVLTree and std::map entries have an int value.
+ */
+struct AVLAdapter {
+    static const bool kRanked = true;
+    AVLTree<int> tree;
+
+    void Insert(int key) {
+        tree.Emplace(key, key);
+    }
+
+    bool Find(int key) {
+        return tree.find(key) != nullptr;
+    }
+
+    int Rank(int key) {
+        return tree.Rank(key);
+    }
+
+    bool Select(int index) {
+        return tree.Select(index) != nullptr;
+    }
+
+    void Erase(int key) {
+        tree.RemoveNode(key);
+    }
+
+    long long Traverse() {
+        long long sum = 0;
+        for (AVLTree<int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->key;
+        }
+        return sum;
+    }
+};
+
+struct CompactAdapter {
+    static const bool kRanked = true;
+    CompactAVLTree<int> tree;
+
+    void Insert(int key) {
+        tree.Emplace(key, key);
+    }
+
+    bool Find(int key) {
+        return tree.find(key) != nullptr;
+    }
+
+    int Rank(int key) {
+        return tree.Rank(key);
+    }
+
+    bool Select(int index) {
+        return tree.Select(index) != nullptr;
+    }
+
+    void Erase(int key) {
+        tree.RemoveNode(key);
+    }
+
+    long long Traverse() {
+        long long sum = 0;
+        tree.ForEach([&sum](const CompactAVLNode<int> &node) { sum += node.key; });
+        return sum;
+    }
+};
+
+struct BucketedAdapter {
+    static const bool kRanked = true;
+    BucketedAVLTree<int> tree;
+
+    void Insert(int key) {
+        tree.Emplace(key, key);
+    }
+
+    bool Find(int key) {
+        return tree.find(key) != nullptr;
+    }
+
+    int Rank(int key) {
+        return tree.Rank(key);
+    }
+
+    bool Select(int index) {
+        return tree.Select(index) != nullptr;
+    }
+
+    void Erase(int key) {
+        tree.RemoveNode(key);
+    }
+
+    long long Traverse() {
+        long long sum = 0;
+        tree.ForEach([&sum](int key, const int &) { sum += key; });
+        return sum;
+    }
+};
+
+struct MapAdapter {
+    static const bool kRanked = false;
+    std::map<int, int> map;
+
+    void Insert(int key) {
+        map.emplace(key, key);
+    }
+
+    bool Find(int key) {
+        return map.find(key) != map.end();
+    }
+
+    int Rank(int) {
+        return -1;
+    }
+
+    bool Select(int) {
+        return false;
+    }
+
+    void Erase(int key) {
+        map.erase(key);
+    }
+
+    long long Traverse() {
+        long long sum = 0;
+        for (const std::pair<const int, int> &entry : map) {
+            sum += entry.first;
+        }
+        return sum;
+    }
+};
+
+struct SetAdapter {
+    static const bool kRanked = false;
+    std::set<int> set;
+
+    void Insert(int key) {
+        set.insert(key);
+    }
+
+    bool Find(int key) {
+        return set.find(key) != set.end();
+    }
+
+    int Rank(int) {
+        return -1;
+    }
+
+    bool Select(int) {
+        return false;
+    }
+
+    void Erase(int key) {
+        set.erase(key);
+    }
+
+    long long Traverse() {
+        long long sum = 0;
+        for (int key : set) {
+            sum += key;
+        }
+        return sum;
+    }
+};
+
+//*********************************************************************
+/**
+ * runs op(i) for every i in [0, n) without any timing inside the loop.
+ * @return the ops per second.
+ */
+template<class Op>
+double Throughput(int n, Op op) {
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < n; i++) {
+        op(i);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return seconds > 0 ? n / seconds : 0;
+}
+
+/**
+ * runs op(i) for every i in [0, n), timing every stride-th op on its own, and fills the percentiles of the result.
+ */
+template<class Op>
+void Latency(Result &result, int n, Op op) {
+    int stride = n > kMaxSamples ? (n + kMaxSamples - 1) / kMaxSamples : 1;
+    std::vector<long long> samples;
+    samples.reserve(n / stride + 1);
+    for (int i = 0; i < n; i++) {
+        if (i % stride) {
+            op(i);
+            continue;
+        }
+        Clock::time_point before = Clock::now();
+        op(i);
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        std::size_t index = static_cast<std::size_t>(std::ceil(p * samples.size()));
+        return static_cast<double>(samples[index ? index - 1 : 0]);
+    };
+    result.has_latency = true;
+    result.p50_ns = percentile(0.5);
+    result.p99_ns = percentile(0.99);
+    result.p999_ns = percentile(0.999);
+}
+
+template<class Op>
+Result Read(const Result &base, const char *op_name, int n, Op op) {
+    Result result = base;
+    result.op = op_name;
+    result.ops_per_sec = Throughput(n, op);
+    Latency(result, n, op);
+    return result;
+}
+
+template<class Adapter>
+void Run(const char *name, const Workload &workload, std::vector<Result> &results) {
+    int n = static_cast<int>(workload.insert_order.size());
+    const std::vector<int> &inserts = workload.insert_order;
+    const std::vector<int> &queries = workload.queries;
+    const std::vector<int> &erases = workload.erase_order;
+    Result base = {name, workload.name, n, "", 0, false, 0, 0, 0, 0};
+    long long sum = 0;
+
+    long long before = live_bytes.load();
+    Adapter *adapter = new Adapter();
+    Result insert = base, erase = base;
+    insert.op = "insert";
+    erase.op = "erase";
+    insert.ops_per_sec = Throughput(n, [&](int i) { adapter->Insert(inserts[i]); });
+    base.bytes_per_entry = static_cast<double>(live_bytes.load() - before) / n;
+    insert.bytes_per_entry = erase.bytes_per_entry = base.bytes_per_entry;
+    results.push_back(insert);
+    std::size_t insert_row = results.size() - 1;
+
+    results.push_back(Read(base, "find", n, [&](int i) { sum += adapter->Find(queries[i]); }));
+    if (Adapter::kRanked) {
+        results.push_back(Read(base, "rank", n, [&](int i) { sum += adapter->Rank(queries[i]); }));
+        results.push_back(Read(base, "select", n, [&](int i) { sum += adapter->Select(queries[i] / 8 + 1); }));
+    }
+    Result traverse = base;
+    traverse.op = "traverse";
+    Clock::time_point start = Clock::now();
+    sum += adapter->Traverse();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    traverse.ops_per_sec = seconds > 0 ? n / seconds : 0;
+    results.push_back(traverse);
+
+    // the latencies of the inserts and erases come from filling and emptying the structure a second time.
+    erase.ops_per_sec = Throughput(n, [&](int i) { adapter->Erase(erases[i]); });
+    Latency(results[insert_row], n, [&](int i) { adapter->Insert(inserts[i]); });
+    Latency(erase, n, [&](int i) { adapter->Erase(erases[i]); });
+    results.push_back(erase);
+    delete adapter;
+    sink = sum;
+}
+
+/**
+ * the frozen snapshot only answers queries, it is made from a tree built from the sorted keys.
+ */
+void RunFrozen(const Workload &workload, std::vector<Result> &results) {
+    int n = static_cast<int>(workload.insert_order.size());
+    const std::vector<int> &queries = workload.queries;
+    std::vector<std::pair<int, int> > pairs;
+    pairs.reserve(n);
+    for (int i = 0; i < n; i++) {
+        pairs.push_back(std::make_pair(8 * i, 8 * i));
+    }
+    AVLTree<int> tree;
+    tree.BuildFromSorted(pairs.begin(), pairs.end());
+    std::vector<std::pair<int, int> >().swap(pairs);
+    long long before = live_bytes.load();
+    FrozenAVLTree<int> frozen = Freeze(tree);
+    Result base = {"frozen", workload.name, n, "", 0, false, 0, 0, 0,
+                   static_cast<double>(live_bytes.load() - before) / n};
+    long long sum = 0;
+    results.push_back(Read(base, "find", n, [&](int i) { sum += frozen.find(queries[i]) != nullptr; }));
+    results.push_back(Read(base, "rank", n, [&](int i) { sum += frozen.Rank(queries[i]); }));
+    results.push_back(Read(base, "select", n, [&](int i) { sum += frozen.Select(queries[i] / 8 + 1) != nullptr; }));
+    sink = sum;
+}
+
+//*********************************************************************
+void PrintCsv(const std::vector<Result> &results) {
+    std::cout << "structure,workload,size,op,ops_per_sec,p50_ns,p99_ns,p999_ns,bytes_per_entry" << std::endl;
+    for (const Result &result : results) {
+        std::cout << result.structure << "," << result.workload << "," << result.size << "," << result.op << ","
+                  << result.ops_per_sec << ",";
+        if (result.has_latency) {
+            std::cout << result.p50_ns << "," << result.p99_ns << "," << result.p999_ns;
+        } else {
+            std::cout << ",,";
+        }
+        std::cout << "," << result.bytes_per_entry << std::endl;
+    }
+}
+
+void PrintJson(const std::vector<Result> &results) {
+    std::cout << "{\"benchmarks\": [" << std::endl;
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        std::cout << "  {\"structure\": \"" << result.structure << "\", \"workload\": \"" << result.workload
+                  << "\", \"size\": " << result.size << ", \"op\": \"" << result.op
+                  << "\", \"ops_per_sec\": " << result.ops_per_sec;
+        if (result.has_latency) {
+            std::cout << ", \"p50_ns\": " << result.p50_ns << ", \"p99_ns\": " << result.p99_ns
+                      << ", \"p999_ns\": " << result.p999_ns;
+        } else {
+            std::cout << ", \"p50_ns\": null, \"p99_ns\": null, \"p999_ns\": null";
+        }
+        std::cout << ", \"bytes_per_entry\": " << result.bytes_per_entry << "}"
+                  << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    std::cout << "]}" << std::endl;
+}
+
+/**
+ * parses a comma separated list of sizes, each with an optional K / M suffix.
+ */
+std::vector<int> ParseSizes(const std::string &list) {
+    std::vector<int> sizes;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) continue;
+        long long multiplier = 1;
+        char suffix = item[item.size() - 1];
+        if (suffix == 'K' || suffix == 'k') multiplier = 1000;
+        if (suffix == 'M' || suffix == 'm') multiplier = 1000 * 1000;
+        long long size = std::atoll(item.c_str()) * multiplier;
+        if (size > 0 && size <= (1LL << 28)) sizes.push_back(static_cast<int>(size));
+        else std::cerr << "ignoring size " << item << std::endl;
+    }
+    return sizes;
+}
+
+std::vector<std::string> ParseList(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> sizes = ParseSizes("1K,10K,100K,1M");
+    std::vector<std::string> workloads = ParseList("uniform,sequential,reverse,zipf");
+    std::string format = "csv";
+    unsigned seed = 42;
+    double theta = 0.99;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--sizes") sizes = ParseSizes(argv[i + 1]);
+        else if (flag == "--workloads") workloads = ParseList(argv[i + 1]);
+        else if (flag == "--format") format = argv[i + 1];
+        else if (flag == "--seed") seed = static_cast<unsigned>(std::atoll(argv[i + 1]));
+        else if (flag == "--zipf-theta") theta = std::atof(argv[i + 1]);
+        else {
+            std::cerr << "unknown flag " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (int size : sizes) {
+        for (const std::string &name : workloads) {
+            if (name != "uniform" && name != "sequential" && name != "reverse" && name != "zipf") {
+                std::cerr << "unknown workload " << name << std::endl;
+                return 1;
+            }
+            Workload workload = MakeWorkload(name, size, seed, theta);
+            Run<AVLAdapter>("avl", workload, results);
+            Run<CompactAdapter>("compact", workload, results);
+            Run<BucketedAdapter>("bucketed", workload, results);
+            Run<MapAdapter>("map", workload, results);
+            Run<SetAdapter>("set", workload, results);
+            RunFrozen(workload, results);
+        }
+    }
+    if (format == "json") PrintJson(results);
+    else PrintCsv(results);
+    return 0;
+}
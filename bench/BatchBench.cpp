@@ -0,0 +1,88 @@
+//
+// Batched lookups: a loop of single find / Rank / Select calls against FindBatch / RankBatch / SelectBatch on
+// trees of growing size, with uniformly random keys. the gain shows once the tree no longer fits in the cache.
+// built by bench/CMakeLists.txt
+// usage: BatchBench [max keys] [lookups] [batch]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int lookups, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return lookups / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int max_keys = argc > 1 ? std::atoi(argv[1]) : 1 << 24;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 1 << 22;
+    int batch = argc > 3 ? std::atoi(argv[3]) : 1 << 10;
+    std::cout << "keys,tree_mb,find_mops,find_batch_mops,rank_mops,rank_batch_mops,select_mops,select_batch_mops"
+              << std::endl;
+    for (int keys = 1 << 12; keys <= max_keys; keys *= 4) {
+        std::mt19937 generator(keys);
+        std::vector<std::pair<int, int> > pairs;
+        for (int i = 0; i < keys; i++) {
+            pairs.emplace_back(static_cast<int>(generator()), i);
+        }
+        AVLTree<int> tree;
+        for (const std::pair<int, int> &pair : pairs) {
+            tree.Emplace(pair.first, pair.second);
+        }
+        std::vector<int> queries(lookups), indices(lookups);
+        for (int i = 0; i < lookups; i++) {
+            queries[i] = pairs[generator() % keys].first;
+            indices[i] = static_cast<int>(generator() % tree.size) + 1;
+        }
+        long long checksum = 0;
+        std::vector<int> chunk(batch);
+        std::vector<AVLTree<int>::Node *> nodes;
+        std::vector<int> ranks;
+        // the batched versions get the lookups a batch at a time, as a caller with a stream of keys would.
+        auto batched = [&](const std::vector<int> &input, auto run) {
+            for (int first = 0; first < lookups; first += batch) {
+                int last = first + batch < lookups ? first + batch : lookups;
+                chunk.assign(input.begin() + first, input.begin() + last);
+                run();
+            }
+        };
+        double find = Mops(lookups, [&] {
+            for (int key : queries) checksum += tree.find(key)->key;
+        });
+        double find_batch = Mops(lookups, [&] {
+            batched(queries, [&] {
+                tree.FindBatch(chunk, nodes);
+                for (AVLTree<int>::Node *node : nodes) checksum += node->key;
+            });
+        });
+        double rank = Mops(lookups, [&] {
+            for (int key : queries) checksum += tree.Rank(key);
+        });
+        double rank_batch = Mops(lookups, [&] {
+            batched(queries, [&] {
+                tree.RankBatch(chunk, ranks);
+                for (int r : ranks) checksum += r;
+            });
+        });
+        double select = Mops(lookups, [&] {
+            for (int index : indices) checksum += tree.Select(index)->key;
+        });
+        double select_batch = Mops(lookups, [&] {
+            batched(indices, [&] {
+                tree.SelectBatch(chunk, nodes);
+                for (AVLTree<int>::Node *node : nodes) checksum += node->key;
+            });
+        });
+        double tree_mb = static_cast<double>(tree.size) * sizeof(AVLTree<int>::Node) / (1 << 20);
+        std::cout << tree.size << "," << tree_mb << "," << find << "," << find_batch << "," << rank << ","
+                  << rank_batch << "," << select << "," << select_batch << std::endl;
+        if (checksum == 42) std::cout << std::endl; // keeps the lookups from being optimized away.
+    }
+    return 0;
+}
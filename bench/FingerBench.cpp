@@ -0,0 +1,65 @@
+//
+// Monotonic and near-sorted key streams: AddNode from the root against the finger mode and EmplaceHint(end()),
+// with std::vector::push_back as the bound. near-sorted swaps every key with a close one with some probability.
+// built by bench/CMakeLists.txt
+// usage: FingerBench [keys] [disorder percent]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int keys, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return keys / seconds / 1e6;
+}
+
+template<class Tree>
+double Insert(const std::vector<int> &stream, bool finger, bool hint) {
+    Tree tree;
+    tree.SetFingerMode(finger);
+    return Mops(static_cast<int>(stream.size()), [&] {
+        for (int key : stream) {
+            if (hint) tree.EmplaceHint(tree.end(), key, key);
+            else tree.Emplace(key, key);
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1 << 22;
+    int disorder = argc > 2 ? std::atoi(argv[2]) : 5;
+    std::vector<int> increasing(keys);
+    for (int i = 0; i < keys; i++) {
+        increasing[i] = i;
+    }
+    std::vector<int> near_sorted = increasing;
+    std::mt19937 generator(7);
+    for (int i = 0; i + 1 < keys; i++) {
+        if (static_cast<int>(generator() % 100) < disorder) {
+            std::swap(near_sorted[i], near_sorted[i + 1 + generator() % std::min(16, keys - i - 1)]);
+        }
+    }
+    double vector_mops = Mops(keys, [&] {
+        std::vector<std::pair<int, int> > appended;
+        for (int key : increasing) appended.emplace_back(key, key);
+    });
+    typedef AVLTree<int> Ranked;
+    typedef AVLTree<int, AVLNodePool, NoAugment> Plain;
+    std::cout << "stream,vector_mops,root_mops,finger_mops,hint_end_mops,plain_finger_mops" << std::endl;
+    const std::pair<const char *, const std::vector<int> *> streams[] = {{"increasing",  &increasing},
+                                                                         {"near_sorted", &near_sorted}};
+    for (const auto &stream : streams) {
+        const std::vector<int> &keys_stream = *stream.second;
+        std::cout << stream.first << "," << vector_mops << "," << Insert<Ranked>(keys_stream, false, false) << ","
+                  << Insert<Ranked>(keys_stream, true, false) << "," << Insert<Ranked>(keys_stream, false, true)
+                  << "," << Insert<Plain>(keys_stream, true, false) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+//
+// Compares find on a live AVLTree with find on its frozen snapshot.
+// built by bench/CMakeLists.txt
+// usage: FrozenBench [keys] [lookups]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../AVLTree.h"
+#include "../FrozenAVLTree.h"
+
+int main(int argc, char **argv) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1 << 22;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 1 << 24;
+
+    std::mt19937 generator(12345);
+    std::vector<std::pair<int, int> > pairs;
+    pairs.reserve(keys);
+    for (int i = 0; i < keys; i++) {
+        pairs.push_back(std::make_pair(static_cast<int>(generator() >> 1), i));
+    }
+    AVLTree<int> tree;
+    tree.BuildFromUnsorted(pairs);
+    FrozenAVLTree<int> frozen = Freeze(tree);
+
+    // half of the queries hit, half are random.
+    std::vector<int> queries(lookups);
+    for (int i = 0; i < lookups; i++) {
+        queries[i] = (i & 1) ? static_cast<int>(generator() >> 1) : tree.Select(1 + generator() % tree.size)->key;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    long long live_hits = 0;
+    Clock::time_point start = Clock::now();
+    for (int key : queries) {
+        live_hits += tree.find(key) != nullptr;
+    }
+    double live_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    long long frozen_hits = 0;
+    start = Clock::now();
+    for (int key : queries) {
+        frozen_hits += frozen.find(key) != nullptr;
+    }
+    double frozen_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (live_hits != frozen_hits) {
+        std::cerr << "mismatch: " << live_hits << " != " << frozen_hits << std::endl;
+        return 1;
+    }
+    std::cout << "keys,lookups,live_mops,frozen_mops,speedup" << std::endl;
+    std::cout << tree.size << "," << lookups << "," << lookups / live_seconds / 1e6 << ","
+              << lookups / frozen_seconds / 1e6 << "," << live_seconds / frozen_seconds << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+//
+// Measures the cold start paths: rebuilding a tree with AddNode, against writing an image once and then mapping it
+// (and querying it in place) or turning it back into a tree.
+// built by bench/CMakeLists.txt
+// usage: ImageBench [keys] [image path]
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../AVLTree.h"
+#include "../MappedAVLTree.h"
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 1 << 22;
+    std::string path = argc > 2 ? argv[2] : "avl_image_bench.bin";
+    typedef std::chrono::steady_clock Clock;
+    auto seconds_since = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) {
+        keys[i] = 8 * i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    Clock::time_point start = Clock::now();
+    AVLTree<long long> tree;
+    for (int key : keys) {
+        tree.Emplace(key, static_cast<long long>(key));
+    }
+    double add_seconds = seconds_since(start);
+
+    start = Clock::now();
+    if (!WriteImage(tree, path)) {
+        std::cerr << "can't write " << path << std::endl;
+        return 1;
+    }
+    double write_seconds = seconds_since(start);
+
+    start = Clock::now();
+    MappedAVLTree<long long> image;
+    if (!image.Open(path)) {
+        std::cerr << "can't open " << path << ": " << image.Error() << std::endl;
+        return 1;
+    }
+    double open_seconds = seconds_since(start);
+
+    start = Clock::now();
+    long long hits = 0;
+    for (int i = 0; i < count; i++) {
+        hits += image.find(keys[i]) != nullptr;
+    }
+    double find_seconds = seconds_since(start);
+
+    start = Clock::now();
+    AVLTree<long long> thawed;
+    BuildFromImage(thawed, image);
+    double build_seconds = seconds_since(start);
+
+    std::cout << "keys,add_node_rebuild_s,write_image_s,open_verify_s,mapped_find_mops,build_from_image_s,hits"
+              << std::endl;
+    std::cout << count << "," << add_seconds << "," << write_seconds << "," << open_seconds << ","
+              << count / find_seconds / 1e6 << "," << build_seconds << "," << hits << std::endl;
+    image.Close();
+    std::remove(path.c_str());
+    return thawed.size == count ? 0 : 1;
+}
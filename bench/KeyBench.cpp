@@ -0,0 +1,99 @@
+//
+// Keys that are not ints: 64-bit ids in an AVLMap<long long> against the int keys of AVLTree, and short string keys
+// looked up by std::string_view, through the transparent std::less<> (no std::string is made) and through a
+// std::string made for every lookup (what a non-transparent comparator needs), with std::map for reference.
+// built by bench/CMakeLists.txt
+// usage: KeyBench [keys] [lookups]
+//
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int ops, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 1 << 22;
+    std::mt19937_64 generator(13);
+    std::vector<long long> ids(count);
+    std::vector<std::string> names(count);
+    for (int i = 0; i < count; i++) {
+        ids[i] = static_cast<long long>(generator() >> 1);
+        names[i] = "user:" + std::to_string(generator() % 1000000000); // longer than the small string buffer.
+    }
+    std::vector<int> probes(lookups);
+    for (int i = 0; i < lookups; i++) {
+        probes[i] = static_cast<int>(generator() % count);
+    }
+    // the lookups come as views into a buffer, the way they come out of a parsed request.
+    std::string buffer;
+    std::vector<std::pair<std::size_t, std::size_t> > views(lookups);
+    for (int i = 0; i < lookups; i++) {
+        views[i] = std::make_pair(buffer.size(), names[probes[i]].size());
+        buffer += names[probes[i]];
+    }
+    long long checksum = 0;
+
+    AVLTree<int> int_tree;
+    AVLMap<long long, int> id_tree;
+    AVLMap<std::string, int, std::less<> > name_tree;
+    std::map<std::string, int, std::less<> > name_map;
+    for (int i = 0; i < count; i++) {
+        int_tree.AddNode(static_cast<int>(ids[i]), i);
+        id_tree.AddNode(ids[i], i);
+        name_tree.AddNode(names[i], i);
+        name_map.emplace(names[i], i);
+    }
+    double int_find = Mops(lookups, [&] {
+        for (int probe : probes) {
+            AVLTree<int>::Node *node = int_tree.find(static_cast<int>(ids[probe]));
+            checksum += node ? node->value : 0;
+        }
+    });
+    double id_find = Mops(lookups, [&] {
+        for (int probe : probes) {
+            AVLMap<long long, int>::Node *node = id_tree.find(ids[probe]);
+            checksum += node ? node->value : 0;
+        }
+    });
+    double view_find = Mops(lookups, [&] {
+        for (const std::pair<std::size_t, std::size_t> &view : views) {
+            AVLMap<std::string, int, std::less<> >::Node *node =
+                    name_tree.find(std::string_view(buffer.data() + view.first, view.second));
+            checksum += node ? node->value : 0;
+        }
+    });
+    double string_find = Mops(lookups, [&] {
+        for (const std::pair<std::size_t, std::size_t> &view : views) {
+            AVLMap<std::string, int, std::less<> >::Node *node =
+                    name_tree.find(std::string(buffer.data() + view.first, view.second));
+            checksum += node ? node->value : 0;
+        }
+    });
+    double map_find = Mops(lookups, [&] {
+        for (const std::pair<std::size_t, std::size_t> &view : views) {
+            std::map<std::string, int, std::less<> >::iterator it =
+                    name_map.find(std::string_view(buffer.data() + view.first, view.second));
+            checksum += it != name_map.end() ? it->second : 0;
+        }
+    });
+    std::cout << "keys,int_find_mops,int64_find_mops,string_view_find_mops,string_find_mops,map_string_view_find_mops"
+              << std::endl;
+    std::cout << count << "," << int_find << "," << id_find << "," << view_find << "," << string_find << ","
+              << map_find << std::endl;
+    if (checksum == 42) std::cout << std::endl; // keeps the lookups from being optimized away.
+    return 0;
+}
@@ -0,0 +1,66 @@
+//
+// Erase latency on an expiry workload: bursts that remove a large share of the keys, with RemoveNode against
+// RemoveNodeLazy (the tombstones purged by themselves past max_tombstone_fraction 0.5) and RemoveNodeLazy with CompactTombstones run between the
+// bursts, as an idle-time cleanup would. every erase is timed on its own.
+// built by bench/CMakeLists.txt
+// usage: LazyEraseBench [keys] [bursts]
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../AVLTree.h"
+
+typedef AVLTree<int, AVLNodePool, LiveSubtreeSize> Tree;
+
+/**
+ * fills the tree, then runs the bursts: each one erases a random half of the keys and adds them back.
+ * @param mode - 0 RemoveNode, 1 RemoveNodeLazy, 2 RemoveNodeLazy and CompactTombstones between the bursts.
+ */
+void Run(const std::string &name, int mode, int keys, int bursts) {
+    Tree tree;
+    if (mode == 1) tree.max_tombstone_fraction = 0.5; // (by default the tree never purges by itself)
+    for (int key = 0; key < keys; key++) {
+        tree.Emplace(key, key);
+    }
+    std::vector<int> order(keys);
+    for (int i = 0; i < keys; i++) {
+        order[i] = i;
+    }
+    std::mt19937 generator(3);
+    std::vector<long long> latencies;
+    latencies.reserve(static_cast<std::size_t>(keys / 2) * bursts);
+    for (int burst = 0; burst < bursts; burst++) {
+        std::shuffle(order.begin(), order.end(), generator);
+        for (int i = 0; i < keys / 2; i++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (mode == 0) tree.RemoveNode(order[i]);
+            else tree.RemoveNodeLazy(order[i]);
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+        if (mode == 2) tree.CompactTombstones(keys);
+        for (int i = 0; i < keys / 2; i++) {
+            tree.Emplace(order[i], order[i]);
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double fraction) {
+        return latencies[static_cast<std::size_t>(fraction * (latencies.size() - 1))];
+    };
+    std::cout << name << "," << percentile(0.5) << "," << percentile(0.99) << "," << percentile(0.999) << ","
+              << latencies.back() << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    int bursts = argc > 2 ? std::atoi(argv[2]) : 4;
+    std::cout << "erase,p50_ns,p99_ns,p999_ns,max_ns" << std::endl;
+    Run("remove", 0, keys, bursts);
+    Run("lazy_purge", 1, keys, bursts);
+    Run("lazy_compact", 2, keys, bursts);
+    return 0;
+}
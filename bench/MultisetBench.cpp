@@ -0,0 +1,80 @@
+//
+// Heavily repeated keys (a histogram: few distinct keys, many copies each, added and removed): AVLTree in multiset
+// mode (SubtreeMultiplicity), AVLTree with a vector of copies per key (the way it was done before the multiset
+// mode) and std::multiset. ends with a Rank over the copies.
+// built by bench/CMakeLists.txt
+// usage: MultisetBench [distinct keys] [ops]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int ops, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int distinct = argc > 1 ? std::atoi(argv[1]) : 1 << 12;
+    int ops = argc > 2 ? std::atoi(argv[2]) : 1 << 22;
+    // two adds for every remove, so the copies pile up. a remove takes a key that was added before.
+    std::mt19937 generator(11);
+    std::vector<int> keys(ops);
+    std::vector<bool> remove(ops);
+    for (int i = 0; i < ops; i++) {
+        keys[i] = static_cast<int>(generator() % distinct);
+        remove[i] = i > 0 && generator() % 3 == 0;
+        if (remove[i]) keys[i] = keys[generator() % i];
+    }
+    long long checksum = 0;
+    double multiset_mode = Mops(ops, [&] {
+        AVLTree<int, AVLNodePool, SubtreeMultiplicity> tree;
+        for (int i = 0; i < ops; i++) {
+            if (remove[i]) tree.RemoveNode(keys[i]);
+            else tree.AddNode(keys[i], 0);
+        }
+        checksum += tree.size + tree.Rank(distinct / 2);
+    });
+    double vectors = Mops(ops, [&] {
+        AVLTree<std::vector<int> > tree;
+        for (int i = 0; i < ops; i++) {
+            AVLTree<std::vector<int> >::Node *node = tree.find(keys[i]);
+            if (remove[i]) {
+                if (!node) continue;
+                node->value.pop_back();
+                if (node->value.empty()) tree.RemoveNode(node);
+            } else {
+                if (!node) node = tree.Emplace(keys[i]).first;
+                node->value.push_back(0);
+            }
+        }
+        long long copies = 0;
+        for (AVLTree<std::vector<int> >::iterator it = tree.begin(); it != tree.end(); ++it) {
+            copies += static_cast<long long>(it->value.size());
+        }
+        checksum += copies;
+    });
+    double set = Mops(ops, [&] {
+        std::multiset<int> tree;
+        for (int i = 0; i < ops; i++) {
+            if (remove[i]) {
+                std::multiset<int>::iterator it = tree.find(keys[i]);
+                if (it != tree.end()) tree.erase(it);
+            } else {
+                tree.insert(keys[i]);
+            }
+        }
+        checksum += static_cast<long long>(tree.size());
+    });
+    std::cout << "distinct,ops,avl_multiset_mops,avl_vector_mops,std_multiset_mops" << std::endl;
+    std::cout << distinct << "," << ops << "," << multiset_mode << "," << vectors << "," << set << std::endl;
+    if (checksum == 42) std::cout << std::endl; // keeps the trees from being optimized away.
+    return 0;
+}
@@ -0,0 +1,91 @@
+//
+// The tree as a scheduler queue: take the earliest deadline, remove it and add a later one. AVLTree with PopMin,
+// with Select(1) and RemoveNode (the way it was done before PopMin), std::set and std::priority_queue.
+// built by bench/CMakeLists.txt
+// usage: PriorityBench [queue size] [ops]
+//
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <set>
+#include <unordered_set>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int ops, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int queue_size = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    int ops = argc > 2 ? std::atoi(argv[2]) : 1 << 22;
+    const int kWindow = queue_size * 4; // a new deadline is up to this far after the one that was taken.
+    // the deadlines: the first queue_size fill the queue, then one is added after every pop. all of them are
+    // different, so every structure pops the same keys in the same order.
+    std::mt19937 generator(5);
+    std::vector<int> initial(queue_size), pushed(ops);
+    std::unordered_set<int> used;
+    std::set<int> simulation;
+    for (int i = 0; i < queue_size; i++) {
+        int key = static_cast<int>(generator() % kWindow);
+        while (!used.insert(key).second) key++;
+        initial[i] = key;
+        simulation.insert(key);
+    }
+    for (int i = 0; i < ops; i++) {
+        int now = *simulation.begin();
+        simulation.erase(simulation.begin());
+        int key = now + 1 + static_cast<int>(generator() % kWindow);
+        while (!used.insert(key).second) key++;
+        pushed[i] = key;
+        simulation.insert(key);
+    }
+    long long checksum = 0;
+    double pop_min = Mops(ops, [&] {
+        AVLTree<int> tree;
+        for (int key : initial) tree.Emplace(key, key);
+        int key = 0, value = 0;
+        for (int i = 0; i < ops; i++) {
+            tree.PopMin(key, value);
+            checksum += key;
+            tree.Emplace(pushed[i], pushed[i]);
+        }
+    });
+    double select_remove = Mops(ops, [&] {
+        AVLTree<int> tree;
+        for (int key : initial) tree.Emplace(key, key);
+        for (int i = 0; i < ops; i++) {
+            int key = tree.Select(1)->key;
+            tree.RemoveNode(key);
+            checksum += key;
+            tree.Emplace(pushed[i], pushed[i]);
+        }
+    });
+    double set = Mops(ops, [&] {
+        std::set<int> queue(initial.begin(), initial.end());
+        for (int i = 0; i < ops; i++) {
+            checksum += *queue.begin();
+            queue.erase(queue.begin());
+            queue.insert(pushed[i]);
+        }
+    });
+    double heap = Mops(ops, [&] {
+        std::priority_queue<int, std::vector<int>, std::greater<int> > queue(initial.begin(), initial.end());
+        for (int i = 0; i < ops; i++) {
+            checksum += queue.top();
+            queue.pop();
+            queue.push(pushed[i]);
+        }
+    });
+    std::cout << "queue_size,avl_pop_min_mops,avl_select_remove_mops,set_mops,priority_queue_mops" << std::endl;
+    std::cout << queue_size << "," << pop_min << "," << select_remove << "," << set << "," << heap << std::endl;
+    if (checksum == 42) std::cout << std::endl; // keeps the pops from being optimized away.
+    return 0;
+}
@@ -0,0 +1,62 @@
+//
+// Measures the rebalancing work of AddNode/RemoveNode: how far up the retrace goes and how many rotations it does.
+// built by bench/CMakeLists.txt
+// usage: RebalanceBench [keys]
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../AVLTree.h"
+
+long long Rotations(const InstrumentationSnapshot &stats) {
+    return stats.Rotations(RotationKind::kLeft) + stats.Rotations(RotationKind::kRight) +
+           stats.Rotations(RotationKind::kLeftRight) + stats.Rotations(RotationKind::kRightLeft);
+}
+
+template<class Tree>
+void Run(const char *name, const std::vector<int> &keys) {
+    typedef std::chrono::steady_clock Clock;
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for (int key : keys) {
+        tree.AddNode(key, key);
+    }
+    double insert_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    int height = tree.root ? tree.root->height : -1;
+    InstrumentationSnapshot inserted = tree.instrument.Snapshot();
+    tree.instrument.Reset();
+
+    start = Clock::now();
+    for (int key : keys) {
+        tree.RemoveNode(key);
+    }
+    double remove_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    InstrumentationSnapshot removed = tree.instrument.Snapshot();
+
+    double n = static_cast<double>(keys.size());
+    std::cout << name << ",insert," << keys.size() << "," << height << "," << n / insert_seconds / 1e6 << ","
+              << inserted.retrace_steps / n << "," << inserted.info_steps / n << "," << Rotations(inserted) / n
+              << "," << inserted.retraces_to_root / n << std::endl;
+    std::cout << name << ",remove," << keys.size() << "," << height << "," << n / remove_seconds / 1e6 << ","
+              << removed.retrace_steps / n << "," << removed.info_steps / n << "," << Rotations(removed) / n
+              << "," << removed.retraces_to_root / n << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    // retrace_per_op is the rebalancing path (before the early stop), info_per_op the rest of the way to the root.
+    std::cout << "augment,op,keys,height,mops,retrace_per_op,info_per_op,rotations_per_op,to_root_per_op" << std::endl;
+    // counters only, the timing here is of the whole loop.
+    Run<AVLTree<int, AVLNodePool, NoAugment, Instrumentation<0> > >("none", keys);
+    Run<AVLTree<int, AVLNodePool, SubtreeSize, Instrumentation<0> > >("size", keys);
+    return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Writer scaling: AVLTree behind one global lock against ShardedAVLTree, with 1, 2, 4 ... threads doing
+// AddNode/RemoveNode on uniformly random keys.
+// built by bench/CMakeLists.txt
+// usage: ShardedBench [max threads] [ops per thread] [key range]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../ShardedAVLTree.h"
+
+struct LockedTree {
+    std::mutex mutex;
+    AVLTree<int> tree;
+
+    void AddNode(int key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.Emplace(key, key);
+    }
+
+    void RemoveNode(int key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.RemoveNode(key);
+    }
+};
+
+struct Sharded {
+    ShardedAVLTree<int> tree;
+
+    void AddNode(int key) {
+        tree.Emplace(key, key);
+    }
+
+    void RemoveNode(int key) {
+        tree.RemoveNode(key);
+    }
+};
+
+template<class Map>
+double Run(int threads, int ops, int range) {
+    Map map;
+    for (int key = 0; key < range; key += 2) {
+        map.AddNode(key);
+    }
+    std::vector<std::thread> workers;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int id = 0; id < threads; id++) {
+        workers.emplace_back([&map, id, ops, range] {
+            std::mt19937 generator(id);
+            for (int i = 0; i < ops; i++) {
+                int key = static_cast<int>(generator() % range);
+                if (i & 1) map.RemoveNode(key);
+                else map.AddNode(key);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(threads) * ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    int ops = argc > 2 ? std::atoi(argv[2]) : 1 << 20;
+    int range = argc > 3 ? std::atoi(argv[3]) : 1 << 22;
+    std::cout << "threads,global_lock_mops,sharded_mops" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << threads << "," << Run<LockedTree>(threads, ops, range) << "," << Run<Sharded>(threads, ops, range)
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+//
+// Thread scaling of the parallel traversals: Reduce (a sum of the values), ParallelForEach (an update of every
+// value) and the serial in-order iterator as the baseline, with pools of 1, 2, 4 ... threads.
+// built by bench/CMakeLists.txt
+// usage: TraversalBench [keys] [max threads] [repeats]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(long long nodes, int repeats, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        op();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nodes * repeats / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1 << 24;
+    int max_threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    int repeats = argc > 3 ? std::atoi(argv[3]) : 5;
+    typedef AVLTree<long long> Tree;
+    Tree tree;
+    std::mt19937 generator(11);
+    for (int i = 0; i < keys; i++) {
+        tree.Emplace(static_cast<int>(generator()), i); // random inserts, so the nodes are scattered in memory.
+    }
+    long long checksum = 0;
+    double serial = Mops(tree.size, repeats, [&] {
+        for (Tree::iterator it = tree.begin(); it != tree.end(); ++it) checksum += it->value;
+    });
+    std::cout << "threads,serial_iterator_mops,reduce_mops,for_each_mops" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        ThreadPool pool(threads);
+        double reduce = Mops(tree.size, repeats, [&] {
+            checksum += tree.Reduce(0LL, [](long long a, long long b) { return a + b; }, pool);
+        });
+        double for_each = Mops(tree.size, repeats, [&] {
+            tree.ParallelForEach([](Tree::Node &node) { node.value++; }, pool);
+        });
+        std::cout << threads << "," << serial << "," << reduce << "," << for_each << std::endl;
+    }
+    if (checksum == 42) std::cout << std::endl; // keeps the traversals from being optimized away.
+    return 0;
+}
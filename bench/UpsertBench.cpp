@@ -0,0 +1,59 @@
+//
+// Counting keys (a key seen for the first time is added with 1, a key seen again is incremented): AVLTree with
+// find and then AddNode (two descents for a new key), with GetOrCreate (one descent), and std::map::operator[].
+// built by bench/CMakeLists.txt
+// usage: UpsertBench [distinct keys] [ops]
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+#include "../AVLTree.h"
+
+template<class Op>
+double Mops(int ops, Op op) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    op();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int distinct = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    int ops = argc > 2 ? std::atoi(argv[2]) : 1 << 22;
+    std::mt19937 generator(7);
+    std::vector<int> keys(ops);
+    for (int i = 0; i < ops; i++) {
+        keys[i] = static_cast<int>(generator() % distinct) * 3;
+    }
+    long long checksum = 0;
+    double find_add = Mops(ops, [&] {
+        AVLTree<long long> tree;
+        for (int key : keys) {
+            AVLTree<long long>::Node *node = tree.find(key);
+            if (node) node->value++;
+            else tree.AddNode(key, 1);
+        }
+        checksum += tree.size;
+    });
+    double get_or_create = Mops(ops, [&] {
+        AVLTree<long long> tree;
+        for (int key : keys) {
+            tree.GetOrCreate(key).first->value++;
+        }
+        checksum += tree.size;
+    });
+    double map = Mops(ops, [&] {
+        std::map<int, long long> tree;
+        for (int key : keys) {
+            tree[key]++;
+        }
+        checksum += static_cast<long long>(tree.size());
+    });
+    std::cout << "distinct,ops,avl_find_add_mops,avl_get_or_create_mops,map_mops" << std::endl;
+    std::cout << distinct << "," << ops << "," << find_add << "," << get_or_create << "," << map << std::endl;
+    if (checksum == 42) std::cout << std::endl; // keeps the trees from being optimized away.
+    return 0;
+}
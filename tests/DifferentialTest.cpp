@@ -0,0 +1,787 @@
+//
+// Randomized differential tests: every operation is run on the tree and on a std::map (std::multiset in the
+// multiset mode), and after every round the whole tree is compared with the model and its invariants are checked
+// (the order of the keys, the parent links, the heights and the balance, the augmentation of every node).
+// built by tests/CMakeLists.txt, run by ctest.
+// usage: DifferentialTest [seed] [rounds]
+//
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../AVLTree.h"
+#include "../BucketedAVLTree.h"
+#include "../CompactAVLTree.h"
+#include "../MappedAVLTree.h"
+#include "TestCheck.h"
+
+typedef std::map<int, int> Model;
+typedef AVLTree<int> Tree;
+typedef AVLTree<int, AVLNodePool, LiveSubtreeSize> LazyTree;
+typedef AVLTree<int, AVLNodePool, SubtreeMultiplicity> MultiTree;
+typedef AVLTree<int, AVLNodePool, SubtreeSum<long long> > SumTree;
+
+const int kKeyRange = 10000; // (big enough for trees that the set operations split between threads)
+
+//*********************************************************************
+/**
+ * checks the subtree and returns its height: the keys are in order, the parents point back, the heights and
+ * balance factors are right and at most 1, and the count of the augmentation adds up.
+ */
+template<class T>
+int CheckNode(T &tree, typename T::Node *node, typename T::Node *parent, const int *low, const int *high) {
+    typedef typename T::augment_type Augment;
+    if (!node) return -1;
+    CHECK(node->parent == parent);
+    CHECK(!low || *low < node->key);
+    CHECK(!high || node->key < *high);
+    int left_height = CheckNode(tree, node->left_son, node, low, &node->key);
+    int right_height = CheckNode(tree, node->right_son, node, &node->key, high);
+    CHECK(node->height == std::max(left_height, right_height) + 1);
+    CHECK(node->balance_factor == left_height - right_height);
+    CHECK(node->balance_factor >= -1 && node->balance_factor <= 1);
+    if constexpr (Augment::kHasSize) {
+        CHECK(Augment::Count(node) ==
+              Augment::Count(node->left_son) + Augment::Count(node->right_son) + Augment::Copies(node));
+    }
+    return node->height;
+}
+
+template<class T>
+void CheckShape(T &tree) {
+    typedef typename T::augment_type Augment;
+    CheckNode(tree, tree.root, static_cast<typename T::Node *>(nullptr), nullptr, nullptr);
+    CHECK(tree.size == Augment::Count(tree.root));
+    CHECK(tree.leftmost == T::Minimum(tree.root));
+    CHECK(tree.rightmost == T::Maximum(tree.root));
+}
+
+//*********************************************************************
+/**
+ * compares a map tree (with or without tombstones) with the model: the iteration, find, Rank and Select, both
+ * ends and the keys around the ones in the model.
+ */
+template<class T>
+void CheckMap(T &tree, const Model &model) {
+    CheckShape(tree);
+    CHECK(tree.size == static_cast<int>(model.size()));
+    typename T::iterator it = tree.begin();
+    int index = 1;
+    for (const std::pair<const int, int> &entry : model) {
+        CHECK(it != tree.end() && it->key == entry.first && it->value == entry.second);
+        if (it != tree.end()) ++it;
+        CHECK(tree.Rank(entry.first) == index);
+        typename T::Node *selected = tree.Select(index);
+        CHECK(selected && selected->key == entry.first);
+        index++;
+    }
+    CHECK(it == tree.end());
+    CHECK(!tree.Select(index));
+    for (int key = -1; key <= kKeyRange; key += 7) {
+        Model::const_iterator found = model.find(key);
+        typename T::Node *node = tree.find(key);
+        CHECK((node != nullptr) == (found != model.end()));
+        if (node && found != model.end()) CHECK(node->value == found->second);
+        if (found == model.end()) CHECK(tree.Rank(key) == -1);
+        Model::const_iterator lower = model.lower_bound(key);
+        typename T::iterator tree_lower = tree.lower_bound(key);
+        CHECK((tree_lower == tree.end()) == (lower == model.end()));
+        if (tree_lower != tree.end() && lower != model.end()) CHECK(tree_lower->key == lower->first);
+    }
+    CHECK(model.empty() ? !tree.PeekMin() : tree.PeekMin() && tree.PeekMin()->key == model.begin()->first);
+    CHECK(model.empty() ? !tree.PeekMax() : tree.PeekMax() && tree.PeekMax()->key == model.rbegin()->first);
+}
+
+template<class T>
+void Fill(T &tree, Model &model, std::mt19937 &generator, int count) {
+    for (int i = 0; i < count; i++) {
+        int key = static_cast<int>(generator() % kKeyRange);
+        int value = static_cast<int>(generator() % 1000);
+        CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+    }
+}
+
+//*********************************************************************
+// AddNode / RemoveNode / Extract / upserts / PopMin / PopMax, with Rank and Select checked after every round.
+void TestSingleOps(std::mt19937 &generator, int rounds) {
+    Tree tree;
+    Model model;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 200; i++) {
+            int key = static_cast<int>(generator() % kKeyRange);
+            int value = static_cast<int>(generator() % 1000);
+            switch (generator() % 6) {
+                case 0:
+                case 1:
+                    CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+                    break;
+                case 2:
+                    tree.RemoveNode(key);
+                    model.erase(key);
+                    break;
+                case 3: {
+                    int extracted = -1;
+                    bool was_there = model.count(key) != 0;
+                    CHECK(tree.Extract(key, extracted) == was_there);
+                    if (was_there) CHECK(extracted == model[key]);
+                    model.erase(key);
+                    break;
+                }
+                case 4:
+                    CHECK(tree.InsertOrAssign(key, value).second == model.insert_or_assign(key, value).second);
+                    break;
+                default: {
+                    int popped_key = 0, popped_value = 0;
+                    if (generator() % 2) {
+                        CHECK(tree.PopMin(popped_key, popped_value) == !model.empty());
+                        if (!model.empty()) {
+                            CHECK(popped_key == model.begin()->first && popped_value == model.begin()->second);
+                            model.erase(model.begin());
+                        }
+                    } else {
+                        CHECK(tree.PopMax(popped_key, popped_value) == !model.empty());
+                        if (!model.empty()) {
+                            CHECK(popped_key == model.rbegin()->first && popped_value == model.rbegin()->second);
+                            model.erase(std::prev(model.end()));
+                        }
+                    }
+                }
+            }
+        }
+        CheckMap(tree, model);
+    }
+}
+
+//*********************************************************************
+// CompactAVLTree and AVLTree run the same stream of Emplace / RemoveNode, with string values (a value that is moved
+// to the wrong node shows), and are compared with std::map through Rank, Select, find and ForEach. the removes of
+// the middle key hit nodes with two sons, which take the key and the value of their successor, and the removed
+// slots are recycled by the following adds.
+void TestCompact(std::mt19937 &generator, int rounds) {
+    typedef std::map<int, std::string> StringModel;
+    CompactAVLTree<std::string> compact;
+    AVLTree<std::string> tree;
+    StringModel model;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 300; i++) {
+            int key = static_cast<int>(generator() % 3000);
+            std::string value = "value of " + std::to_string(key) + " from round " + std::to_string(round);
+            int op = static_cast<int>(generator() % 5);
+            if (op == 4 && !model.empty()) { // the middle key.
+                int middle = static_cast<int>(model.size()) / 2 + 1;
+                CompactAVLTree<std::string>::Node *node = compact.Select(middle);
+                key = node ? node->key : key;
+                op = 3;
+            }
+            if (op < 2) {
+                bool added = model.emplace(key, value).second;
+                CHECK(compact.Emplace(key, value).second == added);
+                CHECK(tree.Emplace(key, value).second == added);
+            } else {
+                bool removed = model.erase(key) != 0;
+                CHECK(compact.RemoveNode(key) == removed);
+                tree.RemoveNode(key);
+            }
+        }
+        CheckShape(tree);
+        int n = static_cast<int>(model.size());
+        CHECK(compact.Size() == n && tree.size == n);
+        CHECK(compact.Height() <= 1.4405 * std::log2(n + 2.0)); // (the AVL bound)
+        int index = 1;
+        for (const std::pair<const int, std::string> &entry : model) {
+            CompactAVLTree<std::string>::Node *node = compact.Select(index);
+            CHECK(node && node->key == entry.first && node->value == entry.second);
+            CHECK(compact.Rank(entry.first) == index && tree.Rank(entry.first) == index);
+            CHECK(compact.find(entry.first) == node);
+            AVLTree<std::string>::Node *tree_node = tree.Select(index);
+            CHECK(tree_node && tree_node->key == entry.first && tree_node->value == entry.second);
+            index++;
+        }
+        CHECK(!compact.Select(index) && !compact.Select(0));
+        for (int key = 1; key < 3000; key += 11) {
+            if (!model.count(key)) CHECK(!compact.find(key) && compact.Rank(key) == -1);
+        }
+        StringModel::const_iterator it = model.begin();
+        compact.ForEach([&](const CompactAVLTree<std::string>::Node &node) {
+            CHECK(it != model.end() && it->first == node.key && it->second == node.value);
+            if (it != model.end()) ++it;
+        });
+        CHECK(it == model.end());
+    }
+    compact.Clear();
+    CHECK(compact.Size() == 0 && !compact.Select(1));
+}
+
+//*********************************************************************
+// BucketedAVLTree with small buckets, so the adds and removes split and merge buckets all the time: the first half
+// of the rounds mostly adds, the second half mostly removes. Rank and Select walk the entry counts of the routing
+// nodes (BucketEntries), so they check the counts after every split and merge.
+void TestBucketed(std::mt19937 &generator, int rounds) {
+    const int kCapacity = 8;
+    BucketedAVLTree<int, kCapacity> tree;
+    Model model;
+    bool split = false, merged = false;
+    for (int round = 0; round < rounds; round++) {
+        bool growing = round < rounds / 2;
+        for (int i = 0; i < 300; i++) {
+            int key = static_cast<int>(generator() % 3000);
+            int buckets = tree.BucketCount();
+            if (generator() % 4 < (growing ? 3u : 1u)) {
+                CHECK(tree.AddNode(key, key * 3) == model.emplace(key, key * 3).second);
+            } else {
+                // (a key that is there, half of the time, or the removes would mostly miss)
+                Model::iterator next = model.lower_bound(key);
+                if (!model.empty() && generator() % 2) key = next == model.end() ? model.begin()->first : next->first;
+                CHECK(tree.RemoveNode(key) == (model.erase(key) != 0));
+            }
+            split = split || tree.BucketCount() > buckets;
+            merged = merged || tree.BucketCount() < buckets;
+        }
+        int n = static_cast<int>(model.size());
+        CHECK(tree.Size() == n);
+        CHECK(tree.BucketCount() >= (n + kCapacity - 1) / kCapacity);
+        int index = 1;
+        for (const std::pair<const int, int> &entry : model) {
+            int key = -1;
+            int *value = tree.Select(index, &key);
+            CHECK(value && key == entry.first && *value == entry.second);
+            CHECK(tree.Rank(entry.first) == index);
+            CHECK(tree.find(entry.first) == value);
+            index++;
+        }
+        CHECK(!tree.Select(index) && !tree.Select(0));
+        for (int key = -1; key <= 3000; key += 13) {
+            if (!model.count(key)) CHECK(!tree.find(key) && tree.Rank(key) == -1);
+        }
+        Model::const_iterator it = model.begin();
+        tree.ForEach([&](int key, int &value) {
+            CHECK(it != model.end() && it->first == key && it->second == value);
+            if (it != model.end()) ++it;
+        });
+        CHECK(it == model.end());
+    }
+    CHECK(rounds < 4 || (split && merged));
+}
+
+//*********************************************************************
+/**
+ * lower_bound, upper_bound (and stepping back from them), the reverse iteration and range(low, high), against
+ * std::map: bounds between, on and outside the keys, empty ranges and low > high.
+ */
+template<class T>
+void CheckBounds(T &tree, const Model &model, std::mt19937 &generator) {
+    typename T::iterator back = tree.end();
+    for (Model::const_reverse_iterator it = model.rbegin(); it != model.rend(); ++it) {
+        --back;
+        CHECK(back != tree.end() && back->key == it->first);
+    }
+    for (int i = 0; i < 200; i++) {
+        int low = static_cast<int>(generator() % (kKeyRange + 200)) - 100; // (some outside the keys)
+        int high = i % 10 == 0 ? low : i % 10 == 1 ? low - 1 - static_cast<int>(generator() % 50) :
+                                        low + static_cast<int>(generator() % 300);
+        if (i % 10 == 2 && !model.empty()) low = high = model.begin()->first;
+        Model::const_iterator lower = model.lower_bound(low);
+        typename T::iterator tree_lower = tree.lower_bound(low);
+        CHECK((tree_lower == tree.end()) == (lower == model.end()));
+        if (tree_lower != tree.end() && lower != model.end()) CHECK(tree_lower->key == lower->first);
+        if (lower != model.begin()) { // the key before the bound.
+            --tree_lower;
+            CHECK(tree_lower != tree.end() && tree_lower->key == std::prev(lower)->first);
+        }
+        Model::const_iterator upper = model.upper_bound(low);
+        typename T::iterator tree_upper = tree.upper_bound(low);
+        CHECK((tree_upper == tree.end()) == (upper == model.end()));
+        if (tree_upper != tree.end() && upper != model.end()) CHECK(tree_upper->key == upper->first);
+        // the range, nothing if low > high.
+        std::vector<int> expected, got;
+        for (Model::const_iterator it = lower; low <= high && it != model.end() && it->first <= high; ++it) {
+            expected.push_back(it->first);
+        }
+        typename T::KeyRange view = tree.range(low, high);
+        for (typename T::KeyRange::iterator it = view.begin(); it != view.end(); ++it) got.push_back(it->key);
+        CHECK(got == expected);
+        CHECK(view.empty() == expected.empty());
+    }
+}
+
+void TestBounds(std::mt19937 &generator, int rounds) {
+    Tree tree;
+    LazyTree lazy;
+    Model model, lazy_model;
+    for (int round = 0; round < rounds; round++) {
+        Fill(tree, model, generator, 50);
+        Fill(lazy, lazy_model, generator, 100);
+        for (int i = 0; i < 60; i++) { // the removes of the lazy tree leave tombstones inside the ranges.
+            Model::iterator it = lazy_model.lower_bound(static_cast<int>(generator() % kKeyRange));
+            if (it != lazy_model.end()) {
+                CHECK(lazy.RemoveNodeLazy(it->first));
+                lazy_model.erase(it);
+            }
+        }
+        CheckBounds(tree, model, generator);
+        CheckBounds(lazy, lazy_model, generator);
+    }
+    // all the nodes are tombstones.
+    LazyTree dead;
+    for (int key = 0; key < 100; key++) dead.AddNode(key, key);
+    for (int key = 0; key < 100; key++) dead.RemoveNodeLazy(key);
+    CheckBounds(dead, Model(), generator);
+    CHECK(dead.begin() == dead.end());
+}
+
+//*********************************************************************
+// finger mode and EmplaceHint: runs of increasing and decreasing keys (the finger hits), keys out of order (it
+// misses), removes in between (of the finger and its neighbours too), and hints that are right, wrong or end().
+// the cached leftmost / rightmost are checked by CheckMap.
+void TestFinger(std::mt19937 &generator, int rounds) {
+    Tree tree;
+    Model model;
+    tree.SetFingerMode(true);
+    int next = kKeyRange / 2, previous = kKeyRange / 2 - 1;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 200; i++) {
+            int value = static_cast<int>(generator() % 1000);
+            int key;
+            switch (generator() % 8) {
+                case 0:
+                case 1: // an append after the biggest key so far.
+                    key = next++;
+                    CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+                    break;
+                case 2: // a prepend.
+                    key = previous--;
+                    CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+                    break;
+                case 3: // anywhere.
+                    key = static_cast<int>(generator() % kKeyRange);
+                    CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+                    break;
+                case 4: { // with the right hint, the first node after the key.
+                    key = static_cast<int>(generator() % kKeyRange);
+                    std::pair<Tree::Node *, bool> added = tree.EmplaceHint(tree.upper_bound(key), key, value);
+                    CHECK(added.second == model.emplace(key, value).second);
+                    CHECK(added.first && added.first->key == key);
+                    break;
+                }
+                case 5: { // with a hint that is (most likely) wrong, or end().
+                    key = static_cast<int>(generator() % kKeyRange);
+                    Tree::Node *hint = tree.size && generator() % 2 ? tree.Select(1 + generator() % tree.size)
+                                                                    : nullptr;
+                    std::pair<Tree::Node *, bool> added = tree.EmplaceHint(hint, key, value);
+                    CHECK(added.second == model.emplace(key, value).second);
+                    CHECK(added.first && added.first->key == key);
+                    break;
+                }
+                case 6: // the last key added, where the finger is, or one of its neighbours.
+                    key = next - 1 - static_cast<int>(generator() % 3);
+                    tree.RemoveNode(key);
+                    model.erase(key);
+                    break;
+                default:
+                    key = static_cast<int>(generator() % kKeyRange);
+                    tree.RemoveNode(key);
+                    model.erase(key);
+            }
+        }
+        CheckMap(tree, model);
+    }
+}
+
+//*********************************************************************
+/**
+ * FindBatch / RankBatch / SelectBatch must give what find / Rank / Select give one by one. the batch sizes go
+ * around multiples of kBatchLanes, the keys include missing ones and the indices out of range ones.
+ */
+template<class T>
+void CheckBatchLookups(T &tree, std::mt19937 &generator) {
+    for (int count : {0, 1, 15, 16, 17, 33, 100}) {
+        std::vector<int> keys, indices;
+        for (int i = 0; i < count; i++) {
+            keys.push_back(static_cast<int>(generator() % (kKeyRange + 20)) - 10); // (some below and above)
+            indices.push_back(static_cast<int>(generator() % (tree.size + 20)) - 10);
+        }
+        std::vector<typename T::Node *> found, selected;
+        std::vector<int> ranks;
+        tree.FindBatch(keys, found);
+        tree.RankBatch(keys, ranks);
+        tree.SelectBatch(indices, selected);
+        CHECK(found.size() == keys.size() && ranks.size() == keys.size() && selected.size() == indices.size());
+        if (found.size() != keys.size() || ranks.size() != keys.size() || selected.size() != indices.size()) return;
+        for (int i = 0; i < count; i++) {
+            CHECK(found[i] == tree.find(keys[i]));
+            CHECK(ranks[i] == tree.Rank(keys[i]));
+            CHECK(selected[i] == tree.Select(indices[i]));
+        }
+    }
+}
+
+void TestBatchLookups(std::mt19937 &generator, int rounds) {
+    Tree tree;
+    LazyTree lazy;
+    Model model, lazy_model;
+    for (int round = 0; round < rounds; round++) {
+        Fill(tree, model, generator, 100);
+        Fill(lazy, lazy_model, generator, 100);
+        for (int i = 0; i < 50; i++) {
+            int key = static_cast<int>(generator() % kKeyRange);
+            tree.RemoveNode(key);
+            model.erase(key);
+            if (lazy.RemoveNodeLazy(key)) lazy_model.erase(key); // (the batches must skip the tombstones too)
+        }
+        CheckBatchLookups(tree, generator);
+        CheckBatchLookups(lazy, generator);
+    }
+    CheckMap(tree, model);
+    CheckMap(lazy, lazy_model);
+}
+
+//*********************************************************************
+// Split / Join / Union / Intersection / Difference, on a thread pool so that the parallel recursion runs too.
+void TestSetOps(std::mt19937 &generator, int rounds, ThreadPool &pool) {
+    for (int round = 0; round < rounds; round++) {
+        Tree a, b;
+        Model model_a, model_b;
+        Fill(a, model_a, generator, static_cast<int>(generator() % 6000));
+        Fill(b, model_b, generator, static_cast<int>(generator() % 6000));
+        switch (round % 4) {
+            case 0: { // Split, then Join back.
+                int key = static_cast<int>(generator() % kKeyRange);
+                Tree right;
+                a.Split(key, right);
+                Model model_right(model_a.upper_bound(key), model_a.end());
+                model_a.erase(model_a.upper_bound(key), model_a.end());
+                CheckMap(a, model_a);
+                CheckMap(right, model_right);
+                a.Join(right);
+                model_a.insert(model_right.begin(), model_right.end());
+                CheckMap(right, Model());
+                break;
+            }
+            case 1: // on equal keys the value of a wins.
+                a.Union(b, pool);
+                model_a.insert(model_b.begin(), model_b.end());
+                CheckMap(b, Model());
+                break;
+            case 2:
+                a.Intersection(b, pool);
+                for (Model::iterator it = model_a.begin(); it != model_a.end();) {
+                    it = model_b.count(it->first) ? std::next(it) : model_a.erase(it);
+                }
+                CheckMap(b, model_b);
+                break;
+            default:
+                a.Difference(b, pool);
+                for (const std::pair<const int, int> &entry : model_b) model_a.erase(entry.first);
+                CheckMap(b, model_b);
+        }
+        CheckMap(a, model_a);
+    }
+}
+
+//*********************************************************************
+// InsertBatch / EraseBatch, small batches (merged) and big ones (the tree is rebuilt), with repeated keys.
+void TestBatches(std::mt19937 &generator, int rounds, ThreadPool &pool) {
+    Tree tree;
+    Model model;
+    for (int round = 0; round < rounds; round++) {
+        int count = static_cast<int>(generator() % (round % 3 == 0 ? 2000 : 50));
+        std::vector<std::pair<int, int> > batch;
+        for (int i = 0; i < count; i++) {
+            batch.emplace_back(static_cast<int>(generator() % kKeyRange), i);
+        }
+        if (generator() % 2) {
+            // like std::map::insert: a key that is already in the tree keeps its value, and of a key twice in
+            // the batch the first occurrence wins. (the values are the indices in the batch, all different)
+            int added = tree.InsertBatch(batch, pool);
+            int old_size = static_cast<int>(model.size());
+            for (const std::pair<int, int> &pair : batch) model.insert(pair);
+            CHECK(added == static_cast<int>(model.size()) - old_size);
+        } else {
+            std::vector<int> keys;
+            for (const std::pair<int, int> &pair : batch) keys.push_back(pair.first);
+            int removed = tree.EraseBatch(keys, pool);
+            int old_size = static_cast<int>(model.size());
+            for (int key : keys) model.erase(key);
+            CHECK(removed == old_size - static_cast<int>(model.size()));
+        }
+        CheckMap(tree, model);
+    }
+}
+
+//*********************************************************************
+// BuildFromSorted from a random access range (std::vector) and from bidirectional ones (std::list, std::map), of
+// every size up to a few nodes and then random ones, and BuildFromUnsorted with repeated keys.
+void TestBuild(std::mt19937 &generator, int rounds) {
+    for (int round = 0; round < rounds + 20; round++) {
+        int count = round < 20 ? round : static_cast<int>(generator() % 3000);
+        Model model;
+        while (static_cast<int>(model.size()) < count) {
+            model[static_cast<int>(generator() % kKeyRange)] = static_cast<int>(generator() % 1000);
+        }
+        std::vector<std::pair<int, int> > sorted(model.begin(), model.end());
+        std::list<std::pair<int, int> > listed(model.begin(), model.end());
+        Model copy = model;
+        Tree from_vector, from_list, from_map;
+        from_vector.AddNode(-1, 0); // (replaced)
+        from_vector.BuildFromSorted(sorted.begin(), sorted.end());
+        from_list.BuildFromSorted(listed.begin(), listed.end());
+        from_map.BuildFromSorted(copy.begin(), copy.end());
+        CheckMap(from_vector, model);
+        CheckMap(from_list, model);
+        CheckMap(from_map, model);
+
+        std::vector<std::pair<int, int> > pairs;
+        for (const std::pair<const int, int> &entry : model) {
+            pairs.emplace_back(entry.first, entry.second);
+            if (generator() % 4 == 0) pairs.emplace_back(entry.first, entry.second);
+        }
+        std::shuffle(pairs.begin(), pairs.end(), generator);
+        Tree unsorted;
+        unsorted.BuildFromUnsorted(pairs);
+        CheckMap(unsorted, model);
+    }
+}
+
+// the keys of the tombstones, in key order.
+std::vector<int> DeadKeys(LazyTree &tree) {
+    std::vector<LazyTree::Node *> nodes;
+    tree.CollectNodes(tree.root, nodes);
+    std::vector<int> dead;
+    for (LazyTree::Node *node : nodes) {
+        if (LiveSubtreeSize::Dead(node)) dead.push_back(node->key);
+    }
+    return dead;
+}
+
+//*********************************************************************
+// CompactTombstones takes the first tombstone in key order, also when an inner node and its left subtree are both
+// tombstones.
+void TestCompactOrder() {
+    LazyTree tree;
+    Model model;
+    for (int key = 1; key <= 15; key++) {
+        tree.AddNode(key, key);
+        model[key] = key;
+    }
+    int inner = tree.root->key;
+    int left = tree.root->left_son->right_son->key; // (in the left subtree of the root, not at its end)
+    tree.RemoveNodeLazy(inner);
+    tree.RemoveNodeLazy(left);
+    model.erase(inner);
+    model.erase(left);
+    CHECK(tree.CompactTombstones(1) == 1);
+    CHECK(DeadKeys(tree) == std::vector<int>(1, inner));
+    CheckMap(tree, model);
+    CHECK(tree.CompactTombstones(5) == 1);
+    CHECK(DeadKeys(tree).empty());
+    CheckMap(tree, model);
+}
+
+//*********************************************************************
+// RemoveNodeLazy and the tombstones: Rank / Select / the iterators skip them, a key can come back, and the
+// compaction, the purge and the operations that drop them first leave the same content.
+void TestTombstones(std::mt19937 &generator, int rounds, ThreadPool &pool) {
+    LazyTree tree;
+    Model model;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 200; i++) {
+            int key = static_cast<int>(generator() % kKeyRange);
+            int value = static_cast<int>(generator() % 1000);
+            if (generator() % 2) {
+                CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+            } else {
+                CHECK(tree.RemoveNodeLazy(key) == (model.erase(key) != 0));
+            }
+        }
+        CheckMap(tree, model);
+        switch (round % 4) {
+            case 0: { // the first tombstones in key order go.
+                int budget = static_cast<int>(generator() % 50);
+                std::vector<int> dead = DeadKeys(tree);
+                int removed = tree.CompactTombstones(budget);
+                CHECK(removed == std::min(budget, static_cast<int>(dead.size())));
+                dead.erase(dead.begin(), dead.begin() + removed);
+                CHECK(DeadKeys(tree) == dead);
+                break;
+            }
+            case 1:
+                tree.PurgeTombstones(pool);
+                CHECK(tree.TombstoneCount() == 0);
+                break;
+            case 2: {
+                std::vector<int> keys(1, static_cast<int>(generator() % kKeyRange));
+                model.erase(keys[0]);
+                tree.EraseBatch(keys, pool);
+                CHECK(tree.TombstoneCount() == 0);
+                break;
+            }
+            default: { // the tombstones of the other tree are not matches.
+                LazyTree other;
+                Model model_other;
+                Fill(other, model_other, generator, 500);
+                for (int i = 0; i < 200; i++) {
+                    int key = static_cast<int>(generator() % kKeyRange);
+                    if (other.RemoveNodeLazy(key)) model_other.erase(key);
+                }
+                if (generator() % 2) {
+                    tree.Intersection(other, pool);
+                    for (Model::iterator it = model.begin(); it != model.end();) {
+                        it = model_other.count(it->first) ? std::next(it) : model.erase(it);
+                    }
+                } else {
+                    tree.Difference(other, pool);
+                    for (const std::pair<const int, int> &entry : model_other) model.erase(entry.first);
+                }
+                CheckMap(other, model_other);
+            }
+        }
+        CheckMap(tree, model);
+    }
+}
+
+//*********************************************************************
+// the multiset mode against std::multiset: the copies of every key, Rank (the first copy) and Select (every copy).
+void TestMultiset(std::mt19937 &generator, int rounds, ThreadPool &pool) {
+    MultiTree tree;
+    std::multiset<int> model;
+    for (int round = 0; round < rounds; round++) {
+        int range = 100; // few keys, many copies.
+        for (int i = 0; i < 300; i++) {
+            int key = static_cast<int>(generator() % range);
+            if (generator() % 3) {
+                tree.AddNode(key, 0);
+                model.insert(key);
+            } else {
+                tree.RemoveNode(key);
+                std::multiset<int>::iterator it = model.find(key);
+                if (it != model.end()) model.erase(it);
+            }
+        }
+        if (round % 4 == 0) {
+            std::vector<std::pair<int, int> > batch;
+            for (int i = 0; i < 100; i++) batch.emplace_back(static_cast<int>(generator() % range), 0);
+            CHECK(tree.InsertBatch(batch, pool) == 100);
+            for (const std::pair<int, int> &pair : batch) model.insert(pair.first);
+        } else if (round % 4 == 1) {
+            std::vector<int> keys(1, static_cast<int>(generator() % range));
+            int copies = static_cast<int>(model.count(keys[0]));
+            CHECK(tree.EraseBatch(keys, pool) == copies); // (all the copies)
+            model.erase(keys[0]);
+        }
+        CheckShape(tree);
+        CHECK(tree.size == static_cast<int>(model.size()));
+        int index = 1;
+        for (std::multiset<int>::iterator it = model.begin(); it != model.end(); ++it, index++) {
+            MultiTree::Node *selected = tree.Select(index);
+            CHECK(selected && selected->key == *it);
+        }
+        CHECK(!tree.Select(index));
+        for (int key = 0; key < range; key++) {
+            int copies = static_cast<int>(model.count(key));
+            CHECK(tree.Multiplicity(key) == copies);
+            int rank = static_cast<int>(std::distance(model.begin(), model.lower_bound(key))) + 1;
+            CHECK(tree.Rank(key) == (copies ? rank : -1));
+        }
+    }
+}
+
+//*********************************************************************
+// RangeAggregate after every kind of change, the upserts included.
+void TestAggregates(std::mt19937 &generator, int rounds) {
+    SumTree tree;
+    Model model;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 200; i++) {
+            int key = static_cast<int>(generator() % kKeyRange);
+            int value = static_cast<int>(generator() % 1000);
+            switch (generator() % 4) {
+                case 0:
+                    CHECK(tree.AddNode(key, value) == model.emplace(key, value).second);
+                    break;
+                case 1:
+                    tree.RemoveNode(key);
+                    model.erase(key);
+                    break;
+                case 2:
+                    tree.InsertOrAssign(key, value);
+                    model[key] = value;
+                    break;
+                default: {
+                    SumTree::Node *node = tree.GetOrCreate(key).first;
+                    node->value += value;
+                    tree.UpdatePathInfo(node);
+                    model[key] += value;
+                }
+            }
+        }
+        for (int i = 0; i < 50; i++) {
+            int low = static_cast<int>(generator() % kKeyRange);
+            int high = low + static_cast<int>(generator() % 500);
+            long long sum = 0;
+            for (Model::iterator it = model.lower_bound(low); it != model.end() && it->first <= high; ++it) {
+                sum += it->second;
+            }
+            CHECK(tree.RangeAggregate(low, high) == sum);
+        }
+        CheckShape(tree);
+    }
+}
+
+//*********************************************************************
+// WriteImage, MappedAVLTree on the image, and BuildFromImage back into a tree.
+void TestImage(std::mt19937 &generator, int rounds, const std::string &path) {
+    for (int round = 0; round < rounds; round++) {
+        Tree tree;
+        Model model;
+        Fill(tree, model, generator, static_cast<int>(generator() % 3000));
+        CHECK(WriteImage(tree, path));
+        MappedAVLTree<int> image;
+        CHECK(image.Open(path));
+        CHECK(image.Size() == static_cast<int>(model.size()));
+        int index = 1;
+        for (const std::pair<const int, int> &entry : model) {
+            const MappedRecord<int> *record = image.find(entry.first);
+            CHECK(record && record->value == entry.second);
+            CHECK(image.Rank(entry.first) == index);
+            const MappedRecord<int> *selected = image.Select(index);
+            CHECK(selected && selected->key == entry.first);
+            index++;
+        }
+        CHECK(!image.find(-1) && !image.find(kKeyRange));
+        Tree thawed;
+        BuildFromImage(thawed, image);
+        CheckMap(thawed, model);
+    }
+    std::remove(path.c_str());
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 40;
+    std::mt19937 generator(seed);
+    ThreadPool pool(4);
+    TestSingleOps(generator, rounds);
+    TestCompact(generator, rounds);
+    TestBucketed(generator, rounds);
+    TestBounds(generator, rounds);
+    TestFinger(generator, rounds);
+    TestBatchLookups(generator, rounds);
+    TestSetOps(generator, rounds, pool);
+    TestBatches(generator, rounds, pool);
+    TestBuild(generator, rounds);
+    TestCompactOrder();
+    TestTombstones(generator, rounds, pool);
+    TestMultiset(generator, rounds, pool);
+    TestAggregates(generator, rounds);
+    TestImage(generator, rounds / 4 + 1, "DifferentialTest." + std::to_string(seed) + ".image");
+    return TestResult("DifferentialTest (seed " + std::to_string(seed) + ", " + std::to_string(rounds) + " rounds)");
+}
@@ -0,0 +1,99 @@
+//
+// Freeze(): the snapshot must answer find, Rank, Select and LowerBound like the tree it was made from and like
+// std::map, for sizes around the block size (16 keys) and its powers, and for keys at the ends of the int range
+// (the unused slots of the blocks hold INT_MAX). tests/CMakeLists.txt builds it once per search of a block: with
+// the default flags (SSE2 on x86-64), with AVLTREE_FROZEN_SCALAR (the plain loop) and with AVX2 if the build
+// machine runs it.
+// usage: FrozenTest [seed]
+//
+#include <climits>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "../AVLTree.h"
+#include "../FrozenAVLTree.h"
+#include "TestCheck.h"
+
+typedef std::map<int, int> Model;
+
+//*********************************************************************
+/**
+ * compares the snapshot with the model and the tree, for every key, its neighbours and a few more keys.
+ */
+template<class Tree>
+void CheckFrozen(Tree &tree, const FrozenAVLTree<int> &frozen, const Model &model, std::mt19937 &generator) {
+    CHECK(frozen.Size() == static_cast<int>(model.size()));
+    std::vector<int> queries = {INT_MIN, INT_MIN + 1, -1, 0, 1, INT_MAX - 1, INT_MAX};
+    int index = 1;
+    for (const std::pair<const int, int> &entry : model) {
+        const FrozenEntry<int> *selected = frozen.Select(index);
+        CHECK(selected && selected->key == entry.first && *selected->value == entry.second);
+        CHECK(selected && selected->value == &tree.find(entry.first)->value); // (the values are not copied)
+        index++;
+        queries.push_back(entry.first);
+        if (entry.first != INT_MIN) queries.push_back(entry.first - 1);
+        if (entry.first != INT_MAX) queries.push_back(entry.first + 1);
+    }
+    CHECK(!frozen.Select(0) && !frozen.Select(index));
+    for (int i = 0; i < 100; i++) queries.push_back(static_cast<int>(generator()));
+    for (int key : queries) {
+        Model::const_iterator found = model.find(key);
+        const FrozenEntry<int> *entry = frozen.find(key);
+        CHECK((entry != nullptr) == (found != model.end()));
+        if (entry && found != model.end()) CHECK(entry->key == key && *entry->value == found->second);
+        CHECK(frozen.Rank(key) == tree.Rank(key));
+        CHECK(frozen.Rank(key) == (found == model.end() ? -1 :
+                                   static_cast<int>(std::distance(model.begin(), found)) + 1));
+        Model::const_iterator lower = model.lower_bound(key);
+        const FrozenEntry<int> *frozen_lower = frozen.LowerBound(key);
+        CHECK((frozen_lower == nullptr) == (lower == model.end()));
+        if (frozen_lower && lower != model.end()) CHECK(frozen_lower->key == lower->first);
+        typename Tree::iterator tree_lower = tree.lower_bound(key);
+        CHECK((tree_lower == tree.end()) == (frozen_lower == nullptr));
+        if (frozen_lower && tree_lower != tree.end()) CHECK(frozen_lower->key == tree_lower->key);
+        CHECK(frozen.LowerBoundIndex(key) == static_cast<int>(std::distance(model.begin(), lower)));
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1;
+    std::mt19937 generator(seed);
+    // around one block, one level of blocks (16 + 17 * 16 = 288) and two levels.
+    std::vector<int> sizes = {0, 1, 2, 15, 16, 17, 31, 33, 100, 271, 272, 273, 287, 288, 289, 1000, 4913, 5000};
+    for (int size : sizes) {
+        for (int spread : {3, 1 << 16, 0}) { // dense keys, sparse keys, keys over the whole int range.
+            AVLTree<int> tree;
+            Model model;
+            if (size > 0 && spread == 0) { // (the ends of the int range, the padding value among them)
+                tree.AddNode(INT_MIN, 1);
+                tree.AddNode(INT_MAX, 2);
+                model[INT_MIN] = 1;
+                model[INT_MAX] = 2;
+            }
+            while (static_cast<int>(model.size()) < size) {
+                int key = spread ? static_cast<int>(generator() % (static_cast<unsigned>(size) * spread)) - size :
+                          static_cast<int>(generator());
+                int value = static_cast<int>(generator() % 1000);
+                if (model.emplace(key, value).second) tree.AddNode(key, value);
+            }
+            FrozenAVLTree<int> frozen = Freeze(tree);
+            CheckFrozen(tree, frozen, model, generator);
+        }
+    }
+    // a tree with tombstones is purged by Freeze, the snapshot has the live keys only.
+    AVLTree<int, AVLNodePool, LiveSubtreeSize> lazy;
+    Model model;
+    for (int key = 0; key < 1000; key++) {
+        lazy.AddNode(key, key);
+        if (key % 3) model[key] = key;
+        else lazy.RemoveNodeLazy(key);
+    }
+    CHECK(lazy.TombstoneCount() > 0);
+    FrozenAVLTree<int> frozen = Freeze(lazy);
+    CHECK(lazy.TombstoneCount() == 0);
+    CheckFrozen(lazy, frozen, model, generator);
+    return TestResult("FrozenTest (seed " + std::to_string(seed) + ")");
+}
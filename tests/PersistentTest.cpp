@@ -0,0 +1,112 @@
+//
+// PersistentAVLTree under concurrency: one writer adds and removes keys while reader threads pin snapshots and
+// check them against the versions the writer goes through (computed up front on a std::set), and the replaced
+// nodes must all be reclaimed once the readers are gone. meant to be run under -fsanitize=thread and =address too.
+// (configure with -DAVLTREE_SANITIZER=thread)
+// built by tests/CMakeLists.txt, run by ctest.
+// usage: PersistentTest [seed] [writes] [readers]
+//
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../PersistentAVLTree.h"
+#include "TestCheck.h"
+
+typedef PersistentAVLTree<int> Tree;
+typedef std::unordered_map<std::uint64_t, std::vector<int> > Versions; // the fingerprint of a set, when it was so.
+
+const int kKeyRange = 512;
+
+// a fingerprint of a set of keys, the same for the tree and the model.
+std::uint64_t Fingerprint(std::uint64_t hash, int key) {
+    std::uint64_t x = static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+    return hash + (x ^ (x >> 29)) * 0xBF58476D1CE4E5B9ULL;
+}
+
+//*********************************************************************
+/**
+ * checks one snapshot: the keys come out of Select in order, Rank and find agree with Select, every value is
+ * the one its key was added with, and the set of keys is one of the versions of the writer, not older than the
+ * last version this reader saw.
+ */
+void CheckSnapshot(const Tree::Snapshot &snapshot, const Versions &versions, int &last_version) {
+    std::uint64_t hash = 0;
+    int previous = -1;
+    for (int index = 1; index <= snapshot.Size(); index++) {
+        const PersistentAVLNode<int> *node = snapshot.Select(index);
+        CHECK(node && node->key > previous);
+        if (!node) return;
+        CHECK(*node->value == node->key * 3);
+        CHECK(snapshot.Rank(node->key) == index);
+        CHECK(snapshot.find(node->key) == node);
+        previous = node->key;
+        hash = Fingerprint(hash, node->key);
+    }
+    CHECK(!snapshot.Select(snapshot.Size() + 1));
+    Versions::const_iterator version = versions.find(hash);
+    CHECK(version != versions.end());
+    if (version == versions.end()) return;
+    // the published versions only move forward. (a set that comes back is the earliest of its versions since)
+    std::vector<int>::const_iterator since = std::lower_bound(version->second.begin(), version->second.end(),
+                                                              last_version);
+    CHECK(since != version->second.end());
+    if (since != version->second.end()) last_version = *since;
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1;
+    int writes = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int readers = argc > 3 ? std::atoi(argv[3]) : 4;
+    // every write toggles a key: added if it is not there, removed if it is. version i is the set after i writes.
+    std::mt19937 generator(seed);
+    std::vector<int> keys(writes);
+    std::set<int> model;
+    Versions versions;
+    versions[0].push_back(0);
+    for (int i = 0; i < writes; i++) {
+        keys[i] = static_cast<int>(generator() % kKeyRange);
+        if (!model.erase(keys[i])) model.insert(keys[i]);
+        std::uint64_t hash = 0;
+        for (int key : model) hash = Fingerprint(hash, key);
+        versions[hash].push_back(i + 1);
+    }
+
+    Tree tree;
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++) {
+        threads.emplace_back([&tree, &versions, &done, r] {
+            int last_version = 0;
+            while (!done.load()) {
+                {
+                    Tree::Snapshot snapshot = tree.Pin();
+                    CheckSnapshot(snapshot, versions, last_version);
+                }
+                if (r % 2) tree.TryReclaim();
+            }
+        });
+    }
+    for (int i = 0; i < writes; i++) {
+        int *value = new int(keys[i] * 3);
+        if (tree.AddNode(keys[i], value)) continue;
+        delete value; // (the key was there, the value stays with the caller)
+        CHECK(tree.RemoveNode(keys[i]));
+    }
+    done.store(true);
+    for (std::thread &thread : threads) thread.join();
+
+    // every reader is gone: one more epoch frees everything the last writes replaced.
+    CHECK(tree.Reclaim() == 0);
+    CHECK(tree.PendingCount() == 0);
+    Tree::Snapshot last = tree.Pin();
+    int last_version = 0;
+    CheckSnapshot(last, versions, last_version);
+    CHECK(last.Size() == static_cast<int>(model.size()));
+    return TestResult("PersistentTest (seed " + std::to_string(seed) + ", " + std::to_string(writes) + " writes)");
+}
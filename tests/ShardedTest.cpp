@@ -0,0 +1,115 @@
+//
+// ShardedAVLTree under concurrency: writer threads add and remove keys (each its own keys, so every writer keeps
+// an exact model of them) while reader threads run Rank, Select and Find, with shards small enough to be split and
+// joined all the time. the readers check what holds at any point in time, and after every round the whole tree is
+// compared with the merged models.
+// built by tests/CMakeLists.txt, run by ctest.
+// usage: ShardedTest [seed] [rounds] [max shard size]
+//
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../ShardedAVLTree.h"
+#include "TestCheck.h"
+
+typedef ShardedAVLTree<int> Tree;
+
+const int kKeyRange = 4000;
+const int kWriters = 3;
+const int kReaders = 2;
+const int kAnchorStep = 100; // the multiples of it are added first and never removed.
+
+//*********************************************************************
+/**
+ * the checks that hold while writers run: the anchors are always there, a key at rank r is at least r - 1 (the
+ * keys are distinct and not negative), the rank of the j-th anchor is between j and the anchor + 1, and every
+ * value is the one its key was added with.
+ */
+void CheckWhileWriting(const Tree &tree, std::mt19937 &generator) {
+    int anchor = static_cast<int>(generator() % (kKeyRange / kAnchorStep)) * kAnchorStep;
+    int value = -1;
+    CHECK(tree.Find(anchor, value) && value == anchor * 3);
+    int rank = tree.Rank(anchor);
+    CHECK(rank >= anchor / kAnchorStep + 1 && rank <= anchor + 1);
+    int index = 1 + static_cast<int>(generator() % kKeyRange);
+    int key = -1;
+    if (tree.Select(index, key, value)) {
+        CHECK(key >= index - 1 && key < kKeyRange && value == key * 3);
+    } else {
+        CHECK(index > kKeyRange / kAnchorStep);
+    }
+    CHECK(tree.Size() >= kKeyRange / kAnchorStep && tree.Size() <= kKeyRange);
+}
+
+void CheckAll(const Tree &tree, const std::map<int, int> &model) {
+    CHECK(tree.Size() == static_cast<int>(model.size()));
+    int index = 1;
+    for (const std::pair<const int, int> &entry : model) {
+        int key = -1, value = -1;
+        CHECK(tree.Select(index, key, value) && key == entry.first && value == entry.second);
+        CHECK(tree.Rank(entry.first) == index);
+        index++;
+    }
+    int key = -1, value = -1;
+    CHECK(!tree.Select(index, key, value));
+    for (int k = 0; k < kKeyRange; k++) {
+        CHECK(tree.Contains(k) == (model.count(k) != 0));
+        if (!model.count(k)) CHECK(tree.Rank(k) == -1);
+    }
+    std::map<int, int>::const_iterator it = model.begin();
+    tree.ForEach([&](int k, const int &v) {
+        CHECK(it != model.end() && it->first == k && it->second == v);
+        if (it != model.end()) ++it;
+    });
+    CHECK(it == model.end());
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+    int max_shard_size = argc > 3 ? std::atoi(argv[3]) : 64;
+    Tree tree(max_shard_size);
+    std::vector<std::map<int, int> > models(kWriters);
+    for (int key = 0; key < kKeyRange; key += kAnchorStep) {
+        CHECK(tree.AddNode(key, key * 3));
+    }
+    for (int round = 0; round < rounds; round++) {
+        std::atomic<int> writing(kWriters);
+        std::vector<std::thread> threads;
+        for (int w = 0; w < kWriters; w++) {
+            threads.emplace_back([&, w] {
+                std::mt19937 generator(seed * 1000 + round * kWriters + w);
+                std::map<int, int> &model = models[w];
+                for (int i = 0; i < 3000; i++) {
+                    // writer w owns the keys k % kWriters == w that are not anchors.
+                    int key = static_cast<int>(generator() % (kKeyRange / kWriters)) * kWriters + w;
+                    if (key >= kKeyRange || key % kAnchorStep == 0) continue;
+                    // the first rounds grow the tree, the later ones shrink it, so the shards split and join.
+                    if (generator() % rounds < static_cast<unsigned>(rounds - round)) {
+                        CHECK(tree.Emplace(key, key * 3) == model.emplace(key, key * 3).second);
+                    } else {
+                        CHECK(tree.RemoveNode(key) == (model.erase(key) != 0));
+                    }
+                }
+                writing--;
+            });
+        }
+        for (int r = 0; r < kReaders; r++) {
+            threads.emplace_back([&, r] {
+                std::mt19937 generator(seed * 7777 + round * kReaders + r);
+                while (writing.load()) CheckWhileWriting(tree, generator);
+            });
+        }
+        for (std::thread &thread : threads) thread.join();
+        std::map<int, int> model;
+        for (int key = 0; key < kKeyRange; key += kAnchorStep) model[key] = key * 3;
+        for (const std::map<int, int> &writer_model : models) model.insert(writer_model.begin(), writer_model.end());
+        CheckAll(tree, model);
+    }
+    return TestResult("ShardedTest (seed " + std::to_string(seed) + ", " + std::to_string(rounds) + " rounds, " +
+                      std::to_string(tree.ShardCount()) + " shards at the end)");
+}
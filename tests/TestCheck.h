@@ -0,0 +1,39 @@
+//
+// The check macro of the tests: a failed check is reported with its line and counted, and the test goes on, so
+// one run shows every check that fails. main returns TestResult().
+//
+
+#ifndef MYAVLTREE_TESTCHECK_H
+#define MYAVLTREE_TESTCHECK_H
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+inline std::atomic<int> failures{0};
+inline std::mutex failures_mutex; // (the checks of the concurrent tests report from many threads)
+
+#define CHECK(condition)                                                                                      \
+    do {                                                                                                      \
+        if (!(condition) && failures++ < 20) {                                                                \
+            std::lock_guard<std::mutex> check_lock(failures_mutex);                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " #condition "\n";                         \
+        }                                                                                                     \
+    } while (false)
+
+/**
+ * prints the summary of the run.
+ * @param name - the test and its parameters, for the summary line.
+ * @return the exit code of the test.
+ */
+inline int TestResult(const std::string &name) {
+    if (failures) {
+        std::cerr << name << ": " << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << name << ": all checks passed\n";
+    return 0;
+}
+
+#endif //MYAVLTREE_TESTCHECK_H